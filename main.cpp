@@ -7,6 +7,26 @@
 #include <algorithm>
 #include <cmath>
 #include <stdexcept>
+#include <string>
+#include <cctype>
+#include <deque>
+#include <unordered_set>
+#include <unordered_map>
+#include <random>
+#include <iterator>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 // ============================================================================
 // CACHE CONFIGURATION (Variant 1)
@@ -33,7 +53,8 @@ private:
     const uint32_t MAX_ADDRESS = (1 << ADDRESS_LEN) - 1;
     
 public:
-    std::map<uint32_t, uint8_t> data;
+    // Плоский образ памяти: O(1) доступ без поиска по дереву
+    std::vector<uint8_t> data = std::vector<uint8_t>(MEMORY_SIZE, 0);
     
     void validate_address(uint32_t addr) {
         if (addr > MAX_ADDRESS) {
@@ -80,605 +101,5456 @@ public:
         write8(addr + 2, (val >> 16) & 0xFF);
         write8(addr + 3, (val >> 24) & 0xFF);
     }
+    
+    // Блочные операции (заполнение и вытеснение кэш-линий)
+    void read_block(uint32_t addr, uint8_t* out, uint32_t size) {
+        validate_address(addr);
+        validate_address(addr + size - 1);
+        memcpy(out, &data[addr], size);
+    }
+    
+    void write_block(uint32_t addr, const uint8_t* in, uint32_t size) {
+        validate_address(addr);
+        validate_address(addr + size - 1);
+        memcpy(&data[addr], in, size);
+    }
 };
 
 // ============================================================================
-// CACHE LINE
-// ============================================================================
-struct CacheLine {
-    bool valid = false;
-    uint32_t tag = 0;
-    uint8_t data[CACHE_LINE_SIZE];
-    bool dirty = false;
-    uint32_t lru_counter = 0;
-};
-
-// ============================================================================
-// CACHE (LRU and bit-pLRU)
+// MEMORY PORT (WRITE BUFFER)
 // ============================================================================
-class Cache {
+// Сторона памяти под последним уровнем: учёт трафика в байтах и
+// coalescing write buffer (записи в один блок сливаются до слива в Memory)
+class MemoryPort {
 public:
-    CacheLine sets[CACHE_SET_COUNT][CACHE_WAY];
-    uint32_t global_counter = 0;
-    uint8_t plru_bits[CACHE_SET_COUNT];
+    struct Entry {
+        uint32_t block_addr;
+        uint64_t byte_mask;             // байты блока, ожидающие записи
+        bool has_data;                  // false в tag-only: только учёт трафика
+        uint8_t data[CACHE_LINE_SIZE];
+    };
+    
+    Memory* memory;
+    uint32_t capacity;                  // записей буфера (0 - пишем сразу)
+    uint32_t write_latency;             // такты на запись в память
+    std::deque<Entry> buffer;
     
-    // Детальная статистика
     struct Statistics {
-        uint64_t instr_access = 0, instr_hit = 0, instr_miss = 0;
-        uint64_t data_read_access = 0, data_read_hit = 0, data_read_miss = 0;
-        uint64_t data_write_access = 0, data_write_hit = 0, data_write_miss = 0;
-        uint64_t evictions = 0;
-        uint64_t writebacks = 0;
+        uint64_t read_bytes = 0;        // заполнения линий из памяти
+        uint64_t write_bytes = 0;       // байты, реально записанные в память
+        uint64_t write_requests = 0;    // записи, пришедшие в порт
+        uint64_t coalesced = 0;         // слиты с записью, уже стоящей в буфере
+        uint64_t memory_writes = 0;     // обращения записи к памяти (bursts)
+        uint64_t stalls = 0;            // буфер полон: ждём слива самой старой записи
+        uint64_t read_drains = 0;       // чтение блока, ожидающего в буфере
     } stats;
     
-    Memory* memory;
+    MemoryPort(Memory* mem, uint32_t entries, uint32_t latency)
+        : memory(mem), capacity(entries), write_latency(latency) {}
     
-    Cache(Memory* mem) : memory(mem) {
-        memset(plru_bits, 0, sizeof(plru_bits));
+    // Запись в память; возвращает такты, которые видит источник записи
+    uint32_t write(uint32_t addr, const uint8_t* bytes, uint32_t size) {
+        stats.write_requests++;
+        if (capacity == 0) {
+            commit(addr, bytes, size);
+            return write_latency;
+        }
+        
+        uint32_t block_addr = addr & ~(CACHE_LINE_SIZE - 1);
+        for (Entry& e : buffer) {
+            if (e.block_addr == block_addr) {
+                merge(e, addr, bytes, size);
+                stats.coalesced++;
+                return 0;
+            }
+        }
+        
+        uint32_t latency = 0;
+        if (buffer.size() >= capacity) {
+            drain(buffer.front());
+            buffer.pop_front();
+            stats.stalls++;
+            latency = write_latency;
+        }
+        
+        buffer.push_back(Entry());
+        Entry& e = buffer.back();
+        e.block_addr = block_addr;
+        e.byte_mask = 0;
+        e.has_data = bytes != nullptr;
+        merge(e, addr, bytes, size);
+        return latency;
     }
     
-    uint32_t get_tag(uint32_t addr) {
-        return (addr >> (CACHE_INDEX_LEN + CACHE_OFFSET_LEN)) & ((1 << CACHE_TAG_LEN) - 1);
+    // Заполнение линии или сектора: сначала сливаем ожидающую запись в этот блок
+    void read(uint32_t addr, uint8_t* out, uint32_t size) {
+        uint32_t block_addr = addr & ~(CACHE_LINE_SIZE - 1);
+        for (auto it = buffer.begin(); it != buffer.end(); ++it) {
+            if (it->block_addr == block_addr) {
+                drain(*it);
+                buffer.erase(it);
+                stats.read_drains++;
+                break;
+            }
+        }
+        if (out) memory->read_block(addr, out, size);
+        stats.read_bytes += size;
     }
     
-    uint32_t get_index(uint32_t addr) {
-        return (addr >> CACHE_OFFSET_LEN) & ((1 << CACHE_INDEX_LEN) - 1);
+    void drain_all() {
+        for (Entry& e : buffer) drain(e);
+        buffer.clear();
     }
     
-    uint32_t get_offset(uint32_t addr) {
-        return addr & ((1 << CACHE_OFFSET_LEN) - 1);
+private:
+    void commit(uint32_t addr, const uint8_t* bytes, uint32_t size) {
+        if (bytes) memory->write_block(addr, bytes, size);
+        stats.write_bytes += size;
+        stats.memory_writes++;
     }
     
-    uint32_t get_block_addr(uint32_t addr) {
-        return addr & ~((1 << CACHE_OFFSET_LEN) - 1);
+    void merge(Entry& e, uint32_t addr, const uint8_t* bytes, uint32_t size) {
+        uint32_t offset = addr - e.block_addr;
+        uint64_t bits = size == 64 ? ~0ull : ((1ull << size) - 1);
+        e.byte_mask |= bits << offset;
+        if (bytes) memcpy(e.data + offset, bytes, size);
     }
     
-    void load_line(uint32_t set_idx, uint32_t way_idx, uint32_t addr) {
-        uint32_t block_addr = get_block_addr(addr);
-        CacheLine& line = sets[set_idx][way_idx];
+    // Запись блока с маской байтов - одно обращение к памяти
+    void drain(Entry& e) {
+        uint64_t mask = e.byte_mask;
+        while (mask && e.has_data) {
+            uint32_t start = __builtin_ctzll(mask);
+            uint64_t run = mask >> start;
+            uint32_t len = ~run ? __builtin_ctzll(~run) : 64 - start;
+            memory->write_block(e.block_addr + start, e.data + start, len);
+            mask &= len == 64 ? 0 : ~(((1ull << len) - 1) << start);
+        }
+        stats.write_bytes += __builtin_popcountll(e.byte_mask);
+        stats.memory_writes++;
+    }
+};
+
+// ============================================================================
+// CHECKPOINT FORMAT
+// ============================================================================
+// Бинарный checkpoint: заголовок (magic, версия, геометрия), состояние
+// эмулятора (pc, регистры, память), затем состояние каждого уровня кэша.
+// Все поля - little-endian в порядке записи; при изменении раскладки
+// увеличивается CHECKPOINT_VERSION
+const uint32_t CHECKPOINT_MAGIC = 0x4B435652;     // "RVCK"
+const uint32_t CHECKPOINT_VERSION = 6;       // 2: счётчики инструкций по наборам, 3: сектора, 4: MMU, 5: 32-битные теги,
+                                              // 6: мегастраницы в TLB
+
+template <typename T>
+void write_pod(std::ostream& out, const T& value) {
+    out.write((const char*)&value, sizeof(T));
+}
+
+template <typename T>
+T read_pod(std::istream& in) {
+    T value;
+    if (!in.read((char*)&value, sizeof(T))) throw std::runtime_error("Truncated checkpoint");
+    return value;
+}
+
+template <typename T>
+void write_vector(std::ostream& out, const std::vector<T>& values) {
+    write_pod<uint32_t>(out, values.size());
+    out.write((const char*)values.data(), values.size() * sizeof(T));
+}
+
+// Размер вектора задаёт геометрия текущей конфигурации
+template <typename T>
+void read_vector(std::istream& in, std::vector<T>& values, const char* what) {
+    if (read_pod<uint32_t>(in) != values.size()) {
+        throw std::runtime_error(std::string("Checkpoint mismatch: ") + what);
+    }
+    if (!in.read((char*)values.data(), values.size() * sizeof(T))) {
+        throw std::runtime_error("Truncated checkpoint");
+    }
+}
+
+// ============================================================================
+// CACHE HIERARCHY CONFIGURATION
+// ============================================================================
+// Политика включения уровня относительно уровней над ним
+enum class InclusionPolicy {
+    INCLUSIVE,   // содержит все линии верхних уровней (back-invalidation)
+    EXCLUSIVE,   // хранит только вытесненные сверху линии
+    NINE         // non-inclusive non-exclusive
+};
+
+// Политика записи при попадании (применяется к L1; нижние уровни - write-back)
+enum class WritePolicy {
+    WRITE_BACK,     // store помечает линию dirty
+    WRITE_THROUGH   // store сразу уходит вниз, линия остаётся чистой
+};
+
+// Политика записи при промахе
+enum class WriteMissPolicy {
+    ALLOCATE,       // загрузить линию, затем записать
+    NO_ALLOCATE,    // записать вниз, не загружая линию
+    AROUND          // как no-allocate, и записанная линия уходит из L1 даже при попадании
+};
+
+// Протокол когерентности приватных L1 (--harts)
+enum class CoherenceProtocol {
+    MESI,
+    MOESI           // грязная линия раздаётся без записи в память (O - owner)
+};
+
+struct CacheConfig {
+    std::string name = "L1";
+    uint32_t set_count = CACHE_SET_COUNT;
+    uint32_t ways = CACHE_WAY;
+    InclusionPolicy inclusion = InclusionPolicy::NINE;
+    uint32_t hit_latency = 1;       // такты на попадание в этот уровень
+    uint32_t victim_entries = 0;    // полностью ассоциативный victim cache (0 - нет)
+    WritePolicy write_policy = WritePolicy::WRITE_BACK;
+    WriteMissPolicy write_miss = WriteMissPolicy::ALLOCATE;
+};
+
+// Модель задержек (в тактах)
+struct LatencyConfig {
+    bool enabled = false;
+    uint32_t memory = 100;          // miss penalty: заполнение линии из памяти
+    uint32_t writeback = 10;        // вытеснение грязной линии
+    uint32_t alu = 1;
+    uint32_t mul = 3;
+    uint32_t div = 20;
+    uint32_t load = 1;
+    uint32_t store = 1;
+    uint32_t branch = 1;
+    uint32_t jump = 1;
+    uint32_t system = 1;
+    uint32_t victim = 1;            // попадание в victim cache
+    uint32_t transfer = 20;         // cache-to-cache передача грязной линии
+    uint32_t mispredict = 3;        // перенаправление выборки после неверного предсказания
+};
+
+enum class PrefetcherType { NONE, NEXT_LINE, STRIDE, STREAM };
+
+// Аппаратный prefetcher L1
+struct PrefetchConfig {
+    PrefetcherType type = PrefetcherType::NONE;
+    uint32_t degree = 1;            // линий за одно срабатывание
+    uint32_t delay = 8;             // заполнение приходит через столько обращений
+    uint32_t queue_size = 16;       // максимум заполнений в полёте
+    uint32_t table_size = 64;       // записи PC-таблицы stride
+    uint32_t streams = 4;           // потоковые буферы
+};
+
+enum class TlbPolicy { LRU, FIFO, RANDOM };
+
+// TLB страниц 4 KiB (мегастраницы Sv32 дробятся на 4 KiB записи)
+struct TlbConfig {
+    uint32_t entries = 32;
+    uint32_t ways = 4;              // ways == entries - полностью ассоциативный
+    TlbPolicy policy = TlbPolicy::LRU;
+};
+
+enum class PredictorType { STATIC, BIMODAL, GSHARE, TAGE };
+
+// Предсказание переходов: все предикторы списка видят один поток переходов,
+// такты штрафа считаются по первому
+struct BranchConfig {
+    std::vector<PredictorType> predictors;
+    uint32_t table_bits = 12;       // 2^bits счётчиков (TAGE: на таблицу)
+    uint32_t history_bits = 12;     // глобальная история gshare
+    uint32_t btb_entries = 256;     // direct-mapped
+    uint32_t ras_entries = 8;
+    uint32_t profile = 10;          // top-N условных переходов по промахам
+};
+
+// Начальные таблицы страниц: из образа памяти или построенные перед запуском
+enum class PageMapping { IMAGE, IDENTITY, IDENTITY_MEGA };
+
+// Конфигурация симуляции: levels[0] = L1, далее L2, L3/LLC...
+struct SimConfig {
+    std::vector<CacheConfig> levels = {CacheConfig()};
+    LatencyConfig latency;
+    PrefetchConfig prefetch;
+    bool tag_only = false;          // только теги/состояние, данные - в Memory
+    bool trace_driven = false;      // --trace: значений нет, tag-only без обращений к Memory
+    bool classify_misses = false;   // 3C: compulsory / capacity / conflict
+    uint32_t pc_profile = 0;        // top-N инструкций по data-промахам (0 - выкл.)
+    uint32_t heat_interval = 0;     // обращений L1 на столбец тепловой карты (0 - выкл.)
+    bool reuse_distance = false;    // гистограммы reuse distance потоков L1
+    uint32_t sample_every = 0;      // set sampling L1: каждый k-й набор
+    uint32_t sample_random = 0;     // set sampling L1: столько случайных наборов
+    uint32_t sample_seed = 1;
+    uint32_t write_buffer = 0;      // записей coalescing write buffer перед памятью
+    uint32_t sector_size = CACHE_LINE_SIZE;     // сектора линий последнего уровня (8, 16, 32)
+    uint32_t mshr_entries = 0;      // MSHR L1 (0 - блокирующие промахи)
+    uint32_t harts = 1;             // harts с приватными L1 над общей памятью
+    bool sv32 = false;              // трансляция адресов Sv32 (I-TLB, D-TLB, обход таблиц)
+    uint32_t page_table_root = 0;   // физический адрес корневой таблицы (satp.PPN << 12)
+    PageMapping page_mapping = PageMapping::IMAGE;
+    TlbConfig itlb;
+    TlbConfig dtlb;
+    CoherenceProtocol coherence = CoherenceProtocol::MESI;
+    BranchConfig branch;
+    bool pipeline = false;          // такты по in-order конвейеру IF/ID/EX/MEM/WB
+    bool forwarding = true;         // обход результатов EX/MEM в EX
+};
+
+bool is_power_of_two(uint32_t val) {
+    return val != 0 && (val & (val - 1)) == 0;
+}
+
+uint32_t log2_exact(uint32_t val) {
+    uint32_t bits = 0;
+    while ((1u << bits) < val) bits++;
+    return bits;
+}
+
+const char* inclusion_name(InclusionPolicy policy) {
+    switch (policy) {
+        case InclusionPolicy::INCLUSIVE: return "inclusive";
+        case InclusionPolicy::EXCLUSIVE: return "exclusive";
+        default: return "NINE";
+    }
+}
+
+const char* write_policy_name(WritePolicy policy, WriteMissPolicy miss) {
+    bool through = policy == WritePolicy::WRITE_THROUGH;
+    switch (miss) {
+        case WriteMissPolicy::ALLOCATE: return through ? "through/allocate" : "back/allocate";
+        case WriteMissPolicy::NO_ALLOCATE: return through ? "through/no-allocate" : "back/no-allocate";
+        default: return through ? "through/around" : "back/around";
+    }
+}
+
+// ============================================================================
+// TAG MATCHING (SSE2 / AVX2)
+// ============================================================================
+// Теги набора лежат подряд (structure of arrays), 32 бита на тег (трассы несут
+// полные адреса), поэтому одно сравнение проверяет 8 (AVX2) или 4 (SSE2) ways;
+// результат - битовая маска ways
+inline uint64_t match_tags(const uint32_t* tags, uint32_t ways, uint32_t tag) {
+    uint64_t mask = 0;
+    uint32_t w = 0;
+#if defined(__AVX2__)
+    __m256i key8 = _mm256_set1_epi32(tag);
+    for (; w + 8 <= ways; w += 8) {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(tags + w)), key8);
+        mask |= (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(eq)) << w;
+    }
+#endif
+#if defined(__SSE2__)
+    __m128i key4 = _mm_set1_epi32(tag);
+    for (; w + 4 <= ways; w += 4) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(tags + w)), key4);
+        mask |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(eq)) << w;
+    }
+#endif
+    for (; w < ways; w++) {
+        if (tags[w] == tag) mask |= 1ull << w;
+    }
+    return mask;
+}
+
+// ============================================================================
+// MISS CLASSIFICATION (3C)
+// ============================================================================
+enum class MissType { COMPULSORY, CAPACITY, CONFLICT };
+
+// Теневой полностью ассоциативный LRU-кэш той же ёмкости. Номер блока -> узел
+// в хеш-таблице (трассы адресуют все 32 бита); LRU - интрузивный двусвязный
+// список по узлам
+class MissClassifier {
+    struct Node {
+        uint32_t block;
+        int32_t prev;               // ближе к MRU
+        int32_t next;               // ближе к LRU
+    };
+    
+    std::vector<Node> nodes;
+    std::unordered_map<uint32_t, int32_t> node_of_block;    // узел; -1 - блок уже вытеснен
+    int32_t head = -1;                      // MRU
+    int32_t tail = -1;                      // LRU
+    uint32_t capacity;
+    
+    void unlink(int32_t n) {
+        if (nodes[n].prev != -1) nodes[nodes[n].prev].next = nodes[n].next;
+        else head = nodes[n].next;
+        if (nodes[n].next != -1) nodes[nodes[n].next].prev = nodes[n].prev;
+        else tail = nodes[n].prev;
+    }
+    
+    void push_front(int32_t n) {
+        nodes[n].prev = -1;
+        nodes[n].next = head;
+        if (head != -1) nodes[head].prev = n;
+        head = n;
+        if (tail == -1) tail = n;
+    }
+    
+public:
+    explicit MissClassifier(uint32_t lines) : capacity(lines) {
+        nodes.reserve(lines);
+    }
+    
+    // Вызывается на каждое demand-обращение; возвращает, каким был бы промах
+    MissType observe(uint32_t block_addr) {
+        uint32_t block = block_addr / CACHE_LINE_SIZE;
         
-        // Write back if dirty
-        if (line.valid && line.dirty) {
-            uint32_t old_addr = (line.tag << (CACHE_INDEX_LEN + CACHE_OFFSET_LEN)) | 
-                                (set_idx << CACHE_OFFSET_LEN);
-            for (uint32_t i = 0; i < CACHE_LINE_SIZE; i++) {
-                memory->write8(old_addr + i, line.data[i]);
-            }
-            stats.writebacks++;
+        auto found = node_of_block.try_emplace(block, -1);
+        bool first_touch = found.second;
+        int32_t n = found.first->second;
+        bool shadow_hit = n != -1;
+        if (shadow_hit) {
+            unlink(n);
+        } else if (nodes.size() < capacity) {
+            n = nodes.size();
+            nodes.push_back({block, -1, -1});
+        } else {
+            n = tail;
+            unlink(n);
+            node_of_block[nodes[n].block] = -1;
+            nodes[n].block = block;
         }
+        node_of_block[block] = n;
+        push_front(n);
         
-        // Load new line
-        line.valid = true;
-        line.tag = get_tag(addr);
-        line.dirty = false;
-        for (uint32_t i = 0; i < CACHE_LINE_SIZE; i++) {
-            line.data[i] = memory->read8(block_addr + i);
+        if (first_touch) return MissType::COMPULSORY;
+        return shadow_hit ? MissType::CONFLICT : MissType::CAPACITY;
+    }
+};
+
+// ============================================================================
+// REUSE DISTANCE
+// ============================================================================
+// Reuse distance блока - число различных блоков между двумя его использованиями.
+// Дерево Фенвика по временным меткам: отмечено последнее использование каждого
+// блока, расстояние = число отметок после предыдущего использования (O(log n)).
+// При заполнении дерева метки перенумеровываются подряд и время продолжается с
+// их количества; если живые метки занимают больше половины, дерево удваивается
+class ReuseDistance {
+    uint32_t capacity = 1 << 16;
+    std::vector<uint32_t> tree = std::vector<uint32_t>(capacity + 1, 0);
+    std::unordered_map<uint32_t, int32_t> last_use;     // номер блока -> метка
+    uint32_t clock = 0;
+    
+    void add(uint32_t pos, int32_t delta) {
+        for (pos++; pos <= capacity; pos += pos & -pos) tree[pos] += delta;
+    }
+    
+    // Отметки в позициях [0, pos)
+    uint32_t prefix(uint32_t pos) {
+        uint32_t sum = 0;
+        for (; pos > 0; pos -= pos & -pos) sum += tree[pos];
+        return sum;
+    }
+    
+    void compact() {
+        std::vector<std::pair<int32_t, uint32_t>> live;
+        live.reserve(last_use.size());
+        for (const auto& entry : last_use) live.push_back({entry.second, entry.first});
+        std::sort(live.begin(), live.end());
+        
+        if (live.size() > capacity / 2) capacity *= 2;
+        tree.assign(capacity + 1, 0);
+        clock = 0;
+        for (const auto& entry : live) {
+            last_use[entry.second] = clock;
+            add(clock++, 1);
         }
+    }
+    
+public:
+    // [0] - первое использование (бесконечное расстояние), [1] - расстояние 0,
+    // [k + 1] - расстояние в [2^(k-1), 2^k)
+    std::vector<uint64_t> histogram;
+    
+    void observe(uint32_t block_addr) {
+        if (clock == capacity) compact();
         
-        if (g_debug) {
-            printf("  [CACHE] Loaded line: addr=0x%08X, set=%u, way=%u, tag=0x%02X\n",
-                   block_addr, set_idx, way_idx, line.tag);
+        uint32_t block = block_addr / CACHE_LINE_SIZE;
+        auto found = last_use.try_emplace(block, -1);
+        int32_t prev = found.first->second;
+        uint32_t bucket = 0;
+        if (prev >= 0) {
+            uint32_t distance = prefix(clock) - prefix(prev + 1);
+            bucket = distance == 0 ? 1 : 2 + (31 - __builtin_clz(distance));
+            add(prev, -1);
         }
+        
+        if (histogram.size() <= bucket) histogram.resize(bucket + 1, 0);
+        histogram[bucket]++;
+        found.first->second = clock;
+        add(clock++, 1);
     }
     
-    uint32_t find_lru_victim(uint32_t set_idx) {
-        uint32_t victim = 0;
-        uint32_t min_counter = sets[set_idx][0].lru_counter;
+    uint64_t total() const {
+        uint64_t sum = 0;
+        for (uint64_t count : histogram) sum += count;
+        return sum;
+    }
+};
+
+// ============================================================================
+// PER-PC PROFILE
+// ============================================================================
+// Счётчики data-обращений по PC инструкции: open addressing с линейным
+// пробированием, ёмкость - степень двойки, заполненность не выше 1/2
+class PcProfile {
+public:
+    struct Entry {
+        uint32_t pc = 0;
+        uint32_t accesses = 0;          // 0 - слот свободен
+        uint32_t hits = 0;
+        uint32_t misses = 0;
+        uint32_t writebacks = 0;        // грязные вытеснения, вызванные обращением
+    };
+    
+    std::vector<Entry> slots = std::vector<Entry>(256);
+    uint32_t used = 0;
+    
+    Entry& lookup(uint32_t pc) {
+        uint32_t mask = slots.size() - 1;
+        uint32_t idx = (((pc >> 2) * 0x9E3779B1u) >> 8) & mask;
+        while (slots[idx].accesses != 0 && slots[idx].pc != pc) idx = (idx + 1) & mask;
         
-        for (uint32_t i = 1; i < CACHE_WAY; i++) {
-            if (!sets[set_idx][i].valid) return i;
-            if (sets[set_idx][i].lru_counter < min_counter) {
-                min_counter = sets[set_idx][i].lru_counter;
-                victim = i;
+        if (slots[idx].accesses == 0) {
+            if ((used + 1) * 2 > slots.size()) {
+                grow();
+                return lookup(pc);
             }
+            slots[idx].pc = pc;
+            used++;
         }
-        return victim;
+        return slots[idx];
     }
     
-    uint32_t find_plru_victim(uint32_t set_idx) {
-        // For 4-way: bit0 = root, bit1 = left subtree, bit2 = right subtree
-        uint8_t bits = plru_bits[set_idx];
-        uint32_t way;
-        
-        if ((bits & 0x1) == 0) {
-            way = (bits & 0x2) ? 1 : 0;
-        } else {
-            way = (bits & 0x4) ? 3 : 2;
+    void record(uint32_t pc, bool hit, uint32_t writebacks) {
+        Entry& e = lookup(pc);
+        e.accesses++;
+        if (hit) e.hits++;
+        else e.misses++;
+        e.writebacks += writebacks;
+    }
+    
+    // Худшие по числу промахов (при равенстве - по обращениям)
+    std::vector<Entry> top(uint32_t count) const {
+        std::vector<Entry> result;
+        for (const Entry& e : slots) {
+            if (e.accesses != 0) result.push_back(e);
         }
-        
-        // Check invalid lines first
-        for (uint32_t i = 0; i < CACHE_WAY; i++) {
-            if (!sets[set_idx][i].valid) return i;
+        std::sort(result.begin(), result.end(), [](const Entry& a, const Entry& b) {
+            if (a.misses != b.misses) return a.misses > b.misses;
+            if (a.accesses != b.accesses) return a.accesses > b.accesses;
+            return a.pc < b.pc;
+        });
+        if (result.size() > count) result.resize(count);
+        return result;
+    }
+    
+private:
+    void grow() {
+        std::vector<Entry> old;
+        old.swap(slots);
+        slots.assign(old.size() * 2, Entry());
+        used = 0;
+        for (const Entry& e : old) {
+            if (e.accesses == 0) continue;
+            Entry& moved = lookup(e.pc);
+            moved = e;
+        }
+    }
+};
+
+// ============================================================================
+// MSHR (NON-BLOCKING MISSES)
+// ============================================================================
+// Miss status holding registers L1. Промах занимает запись до прихода линии,
+// а процессор продолжает работу и ждёт только операнд-приёмник загрузки.
+// Обращение к линии, которая ещё в полёте, сливается с её записью. Линия
+// попадает в кэш функционально сразу, MSHR моделируют только время
+class MshrFile {
+public:
+    struct Entry {
+        uint32_t block_addr;
+        uint64_t ready;                 // такт прихода линии
+    };
+    
+    uint32_t capacity;
+    std::vector<Entry> entries;
+    std::vector<uint64_t> occupancy_cycles;     // тактов с n занятыми записями
+    
+    struct Statistics {
+        uint64_t primary = 0;           // промахи, занявшие запись
+        uint64_t merged = 0;            // обращения к линии в полёте
+        uint64_t full_stalls = 0;       // промахи, ждавшие свободной записи
+        uint64_t full_stall_cycles = 0;
+        uint64_t data_stall_cycles = 0; // ожидание данных линии в полёте
+        uint32_t peak = 0;
+    } stats;
+    
+    explicit MshrFile(uint32_t entries_count)
+        : capacity(entries_count), occupancy_cycles(entries_count + 1, 0) {}
+    
+    // Время доходит до now: пришедшие линии освобождают записи
+    void advance(uint64_t now) {
+        while (!entries.empty()) {
+            size_t first = earliest();
+            if (entries[first].ready > now) break;
+            if (entries[first].ready > last_time) {
+                occupancy_cycles[entries.size()] += entries[first].ready - last_time;
+                last_time = entries[first].ready;
+            }
+            entries.erase(entries.begin() + first);
+        }
+        if (now > last_time) {
+            occupancy_cycles[entries.size()] += now - last_time;
+            last_time = now;
         }
-        
-        return way;
     }
     
-    void update_plru(uint32_t set_idx, uint32_t way) {
-        uint8_t& bits = plru_bits[set_idx];
+    // Обращение в такт now, latency - задержка промаха (0 - попадание).
+    // Возвращает такт готовности данных; now сдвигается, если все записи заняты
+    uint64_t request(uint32_t block_addr, uint64_t& now, uint32_t latency) {
+        advance(now);
+        for (const Entry& e : entries) {
+            if (e.block_addr == block_addr) {
+                stats.merged++;
+                return e.ready;
+            }
+        }
+        if (latency == 0) return now;
         
-        if (way == 0 || way == 1) {
-            bits |= 0x1;
-            if (way == 0) bits |= 0x2;
-            else bits &= ~0x2;
-        } else {
-            bits &= ~0x1;
-            if (way == 2) bits |= 0x4;
-            else bits &= ~0x4;
+        if (entries.size() >= capacity) {
+            uint64_t ready = entries[earliest()].ready;
+            stats.full_stalls++;
+            stats.full_stall_cycles += ready - now;
+            now = ready;
+            advance(now);
         }
+        entries.push_back({block_addr, now + latency});
+        stats.primary++;
+        stats.peak = std::max<uint32_t>(stats.peak, entries.size());
+        return now + latency;
     }
     
-    uint32_t access(uint32_t addr, bool is_write, uint32_t write_data, 
-                    uint32_t size, bool is_instruction, bool use_lru) {
-        // Валидация
-        if (size != 1 && size != 2 && size != 4) {
-            throw std::runtime_error("Invalid access size: " + std::to_string(size));
+    // Ожидание всех линий в полёте; возвращает такт завершения
+    uint64_t drain(uint64_t now) {
+        for (const Entry& e : entries) now = std::max(now, e.ready);
+        advance(now);
+        return now;
+    }
+    
+    // Среднее число записей в полёте по тактам, когда занята хотя бы одна
+    double memory_parallelism() const {
+        uint64_t busy = 0, weighted = 0;
+        for (size_t n = 1; n < occupancy_cycles.size(); n++) {
+            busy += occupancy_cycles[n];
+            weighted += n * occupancy_cycles[n];
         }
-        
-        uint32_t offset = get_offset(addr);
-        if (offset + size > CACHE_LINE_SIZE) {
-            throw std::runtime_error("Access crosses cache line boundary at 0x" + 
-                std::to_string(addr));
+        return busy ? (double)weighted / busy : 0.0;
+    }
+    
+private:
+    uint64_t last_time = 0;
+    
+    size_t earliest() const {
+        size_t first = 0;
+        for (size_t i = 1; i < entries.size(); i++) {
+            if (entries[i].ready < entries[first].ready) first = i;
         }
+        return first;
+    }
+};
+
+// ============================================================================
+// PREFETCHERS
+// ============================================================================
+class Prefetcher {
+public:
+    virtual ~Prefetcher() {}
+    virtual const char* name() = 0;
+    
+    // Обучение на demand-обращении; адреса блоков-кандидатов добавляются в out.
+    // prefetch_hit - первое попадание в линию, заполненную prefetch'ем
+    virtual void train(uint32_t pc, uint32_t addr, bool hit, bool prefetch_hit,
+                       bool is_instruction, std::vector<uint32_t>& out) = 0;
+};
+
+// Tagged next-line: срабатывает на промахе и на первом использовании prefetched линии
+class NextLinePrefetcher : public Prefetcher {
+    uint32_t degree;
+    
+public:
+    NextLinePrefetcher(uint32_t d) : degree(d) {}
+    
+    const char* name() override { return "next-line"; }
+    
+    void train(uint32_t, uint32_t addr, bool hit, bool prefetch_hit,
+               bool, std::vector<uint32_t>& out) override {
+        if (hit && !prefetch_hit) return;
+        uint32_t block_addr = addr & ~(CACHE_LINE_SIZE - 1);
+        for (uint32_t i = 1; i <= degree; i++) {
+            out.push_back(block_addr + i * CACHE_LINE_SIZE);
+        }
+    }
+};
+
+// Таблица шагов, индексируемая PC load/store (reference prediction table)
+class StridePrefetcher : public Prefetcher {
+    struct Entry {
+        bool valid = false;
+        uint32_t pc = 0;
+        uint32_t last_addr = 0;
+        int32_t stride = 0;
+        uint8_t confidence = 0;     // 2-битный насыщающийся счётчик
+    };
+    std::vector<Entry> table;
+    uint32_t degree;
+    
+public:
+    StridePrefetcher(uint32_t entries, uint32_t d) : table(entries), degree(d) {}
+    
+    const char* name() override { return "stride"; }
+    
+    void train(uint32_t pc, uint32_t addr, bool, bool,
+               bool is_instruction, std::vector<uint32_t>& out) override {
+        if (is_instruction) return;
         
-        uint32_t tag = get_tag(addr);
-        uint32_t set_idx = get_index(addr);
+        Entry& e = table[(pc >> 2) % table.size()];
+        if (!e.valid || e.pc != pc) {
+            e = Entry();
+            e.valid = true;
+            e.pc = pc;
+            e.last_addr = addr;
+            return;
+        }
         
-        // Update statistics
-        if (is_instruction) {
-            stats.instr_access++;
+        int32_t stride = (int32_t)(addr - e.last_addr);
+        if (stride == e.stride) {
+            if (e.confidence < 3) e.confidence++;
         } else {
-            if (is_write) stats.data_write_access++;
-            else stats.data_read_access++;
+            if (e.confidence > 0) e.confidence--;
+            else e.stride = stride;
         }
+        e.last_addr = addr;
         
-        // Check for hit
-        int hit_way = -1;
-        for (uint32_t i = 0; i < CACHE_WAY; i++) {
-            if (sets[set_idx][i].valid && sets[set_idx][i].tag == tag) {
-                hit_way = i;
+        if (e.confidence < 2 || e.stride == 0) return;
+        
+        uint32_t block_addr = addr & ~(CACHE_LINE_SIZE - 1);
+        for (uint32_t i = 1; i <= degree; i++) {
+            uint32_t target = (addr + e.stride * (int32_t)i) & ~(CACHE_LINE_SIZE - 1);
+            if (target != block_addr) out.push_back(target);
+        }
+    }
+};
+
+// Потоковые буферы (Jouppi): каждый поток ждёт следующий по порядку блок;
+// промах или использование prefetched линии в голове потока продвигает его
+class StreamPrefetcher : public Prefetcher {
+    struct Stream {
+        bool valid = false;
+        uint32_t next_block = 0;    // ожидаемый следующий блок
+        uint64_t last_use = 0;
+    };
+    std::vector<Stream> streams;
+    uint32_t degree;
+    uint64_t clock = 0;
+    
+public:
+    StreamPrefetcher(uint32_t count, uint32_t d) : streams(count), degree(d) {}
+    
+    const char* name() override { return "stream"; }
+    
+    void train(uint32_t, uint32_t addr, bool hit, bool prefetch_hit,
+               bool, std::vector<uint32_t>& out) override {
+        if (hit && !prefetch_hit) return;
+        uint32_t block_addr = addr & ~(CACHE_LINE_SIZE - 1);
+        clock++;
+        
+        Stream* stream = nullptr;
+        for (Stream& s : streams) {
+            if (s.valid && block_addr + degree * CACHE_LINE_SIZE >= s.next_block &&
+                block_addr <= s.next_block) {
+                stream = &s;
                 break;
             }
         }
         
-        if (hit_way != -1) {
-            // HIT
-            if (is_instruction) {
-                stats.instr_hit++;
-            } else {
-                if (is_write) stats.data_write_hit++;
-                else stats.data_read_hit++;
-            }
-            
-            if (g_debug) {
-                printf("  [CACHE] HIT: addr=0x%08X, set=%u, way=%d, %s%s\n",
-                       addr, set_idx, hit_way, 
-                       is_instruction ? "INSTR" : "DATA",
-                       is_write ? " WRITE" : " READ");
-            }
-            
-            // Update LRU/pLRU
-            if (use_lru) {
-                sets[set_idx][hit_way].lru_counter = ++global_counter;
-            } else {
-                update_plru(set_idx, hit_way);
-            }
-            
-            // Handle write
-            if (is_write) {
-                sets[set_idx][hit_way].dirty = true;
-                if (size == 1) sets[set_idx][hit_way].data[offset] = write_data & 0xFF;
-                else if (size == 2) {
-                    sets[set_idx][hit_way].data[offset] = write_data & 0xFF;
-                    sets[set_idx][hit_way].data[offset + 1] = (write_data >> 8) & 0xFF;
-                } else if (size == 4) {
-                    for (int i = 0; i < 4; i++) {
-                        sets[set_idx][hit_way].data[offset + i] = (write_data >> (i * 8)) & 0xFF;
-                    }
-                }
-            }
-            
-            // Read data
-            uint32_t result = 0;
-            if (size == 1) result = sets[set_idx][hit_way].data[offset];
-            else if (size == 2) result = sets[set_idx][hit_way].data[offset] | 
-                                         (sets[set_idx][hit_way].data[offset + 1] << 8);
-            else if (size == 4) {
-                for (int i = 0; i < 4; i++) {
-                    result |= (sets[set_idx][hit_way].data[offset + i] << (i * 8));
-                }
+        // Новый поток вытесняет давно не использованный
+        if (!stream) {
+            stream = &streams[0];
+            for (Stream& s : streams) {
+                if (!s.valid) { stream = &s; break; }
+                if (s.last_use < stream->last_use) stream = &s;
             }
-            return result;
-        } else {
-            // MISS
-            if (is_instruction) {
-                stats.instr_miss++;
-            } else {
-                if (is_write) stats.data_write_miss++;
-                else stats.data_read_miss++;
+            stream->valid = true;
+            stream->next_block = block_addr + CACHE_LINE_SIZE;
+        }
+        stream->last_use = clock;
+        
+        // Держим degree линий впереди текущего блока
+        while (stream->next_block <= block_addr + degree * CACHE_LINE_SIZE) {
+            out.push_back(stream->next_block);
+            stream->next_block += CACHE_LINE_SIZE;
+        }
+    }
+};
+
+Prefetcher* make_prefetcher(const PrefetchConfig& config) {
+    switch (config.type) {
+        case PrefetcherType::NEXT_LINE: return new NextLinePrefetcher(config.degree);
+        case PrefetcherType::STRIDE: return new StridePrefetcher(config.table_size, config.degree);
+        case PrefetcherType::STREAM: return new StreamPrefetcher(config.streams, config.degree);
+        default: return nullptr;
+    }
+}
+
+// ============================================================================
+// ACCESS TRACE
+// ============================================================================
+enum class AccessType : uint8_t { INSTR, READ, WRITE };
+
+// Обращение процессора к L1 (физический адрес)
+struct TraceRecord {
+    uint32_t addr;
+    uint32_t pc;
+    uint8_t size;
+    AccessType type;
+};
+static_assert(sizeof(TraceRecord) == 12, "binary traces store TraceRecord as is");
+
+// Бинарная трасса: магия и массив TraceRecord (little-endian, 2 байта выравнивания)
+const char TRACE_MAGIC[8] = {'R', 'V', 'T', 'R', 'A', 'C', 'E', '1'};
+
+// Сжатая трасса (--record-trace): магия и блоки. Заголовок блока - u32 raw_size,
+// u32 stored_size, u32 records; stored_size == raw_size - блок не сжат.
+// Запись: байт тега (биты 0-1 - тип, 2-3 - log2 размера, 4 - PC явно),
+// varint(zigzag(addr - прошлый addr того же типа)), при флаге -
+// varint(zigzag(pc - прошлый pc)). Без флага PC выборки равен адресу, а у
+// данных - PC прошлой записи. Дельты обнуляются в начале каждого блока
+const char TRACE_MAGIC_PACKED[8] = {'R', 'V', 'T', 'R', 'A', 'C', 'E', '2'};
+const size_t TRACE_BLOCK_SIZE = 1 << 20;
+const size_t TRACE_BLOCK_HEADER = 12;
+const size_t TRACE_MAX_RECORD = 11;     // тег и два varint по 5 байт
+const uint8_t TRACE_EXPLICIT_PC = 0x10;
+
+// Получатель потока обращений к L1 (Cache::trace_sink)
+class TraceSink {
+public:
+    virtual ~TraceSink() {}
+    virtual void record(const TraceRecord& r) = 0;
+};
+
+// Трасса в памяти (--sweep)
+class TraceBuffer : public TraceSink {
+public:
+    std::vector<TraceRecord> records;
+    
+    void record(const TraceRecord& r) override {
+        records.push_back(r);
+    }
+};
+
+inline uint32_t zigzag(uint32_t delta) {
+    return (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+}
+
+inline uint32_t unzigzag(uint32_t value) {
+    return (value >> 1) ^ (0u - (value & 1));
+}
+
+inline uint8_t* put_varint(uint8_t* p, uint32_t value) {
+    while (value >= 0x80) {
+        *p++ = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    *p++ = (uint8_t)value;
+    return p;
+}
+
+inline bool get_varint(const uint8_t*& p, const uint8_t* end, uint32_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 35 && p < end; shift += 7) {
+        uint8_t byte = *p++;
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// Сжатие блока в духе LZ4: последовательности "токен, литералы, смещение u16,
+// длина совпадения". Токен - длина литералов и совпадения минус 4 по полубайту,
+// 15 продолжается байтами до первого не-255. Последняя последовательность -
+// только литералы. Совпадения ищутся по хешу 4 байт (table - LZ_HASH_SIZE)
+const int LZ_HASH_BITS = 14;
+const size_t LZ_HASH_SIZE = 1 << LZ_HASH_BITS;
+const size_t LZ_MIN_MATCH = 4;
+const size_t LZ_MAX_OFFSET = 65535;
+
+inline uint32_t lz_hash(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Размер сжатого блока или 0, если он не меньше capacity
+size_t lz_compress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity, uint32_t* table) {
+    std::fill(table, table + LZ_HASH_SIZE, 0);
+    size_t out = 0;
+    size_t anchor = 0;
+    
+    auto put_length = [&](size_t length) {
+        for (; length >= 255 && out < capacity; length -= 255) dst[out++] = 255;
+        if (out < capacity) dst[out++] = (uint8_t)length;
+    };
+    // Литералы [anchor, end) и совпадение (match == 0 - конец блока)
+    auto put_sequence = [&](size_t end, size_t match, size_t offset) {
+        size_t literals = end - anchor;
+        if (out + literals + literals / 255 + match / 255 + 5 >= capacity) {
+            out = capacity;
+            return;
+        }
+        size_t match_code = match ? match - LZ_MIN_MATCH : 0;
+        dst[out++] = (uint8_t)((std::min<size_t>(literals, 15) << 4) | std::min<size_t>(match_code, 15));
+        if (literals >= 15) put_length(literals - 15);
+        memcpy(dst + out, src + anchor, literals);
+        out += literals;
+        if (!match) return;
+        dst[out++] = (uint8_t)offset;
+        dst[out++] = (uint8_t)(offset >> 8);
+        if (match_code >= 15) put_length(match_code - 15);
+    };
+    
+    size_t i = 0;
+    while (i + LZ_MIN_MATCH <= size && out < capacity) {
+        uint32_t h = lz_hash(src + i);
+        size_t candidate = table[h];
+        table[h] = (uint32_t)i + 1;
+        if (candidate == 0 || i + 1 - candidate > LZ_MAX_OFFSET || memcmp(src + candidate - 1, src + i, 4) != 0) {
+            i++;
+            continue;
+        }
+        candidate--;
+        size_t match = LZ_MIN_MATCH;
+        while (i + match < size && src[candidate + match] == src[i + match]) match++;
+        put_sequence(i, match, i - candidate);
+        i += match;
+        anchor = i;
+    }
+    if (anchor < size) put_sequence(size, 0, 0);
+    return out < capacity ? out : 0;
+}
+
+// Распаковка ровно в size байт; false - блок повреждён
+bool lz_decompress(const uint8_t* src, size_t stored, uint8_t* dst, size_t size) {
+    const uint8_t* end = src + stored;
+    size_t out = 0;
+    auto get_length = [&](size_t& length) {
+        uint8_t byte;
+        do {
+            if (src >= end) return false;
+            byte = *src++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    };
+    
+    while (src < end) {
+        uint8_t token = *src++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !get_length(literals)) return false;
+        if (literals > (size_t)(end - src) || literals > size - out) return false;
+        memcpy(dst + out, src, literals);
+        src += literals;
+        out += literals;
+        if (src == end) break;
+        
+        if (end - src < 2) return false;
+        size_t offset = src[0] | (src[1] << 8);
+        src += 2;
+        size_t match = token & 15;
+        if (match == 15 && !get_length(match)) return false;
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > out || match > size - out) return false;
+        // Совпадение может перекрываться с собой: копирование побайтно
+        for (size_t k = 0; k < match; k++, out++) dst[out] = dst[out - offset];
+    }
+    return out == size;
+}
+
+// Файл только для чтения, отображённый в память: трасса читается подряд один раз
+class MappedFile {
+public:
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    ~MappedFile() {
+        if (data) munmap((void*)data, size);
+    }
+    
+    void open_file(const std::string& filename) {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Cannot open trace: " + filename);
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw std::runtime_error("Cannot stat trace: " + filename);
+        }
+        size = st.st_size;
+        if (size > 0) {
+            void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Cannot map trace: " + filename);
             }
-            stats.evictions++;
-            
-            uint32_t victim = use_lru ? find_lru_victim(set_idx) : find_plru_victim(set_idx);
-            
-            if (g_debug) {
-                printf("  [CACHE] MISS: addr=0x%08X, set=%u, victim_way=%u, %s%s\n",
-                       addr, set_idx, victim,
-                       is_instruction ? "INSTR" : "DATA",
-                       is_write ? " WRITE" : " READ");
+            madvise(mapped, size, MADV_SEQUENTIAL);
+            data = (const uint8_t*)mapped;
+        }
+        close(fd);
+    }
+};
+
+inline int hex_digit(uint8_t c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// fn(record) для каждой записи трассы: бинарной (TRACE_MAGIC), сжатой
+// (TRACE_MAGIC_PACKED) или Dinero din ("<label> <hex address>": 0 - чтение,
+// 1 - запись, 2 - выборка; 3 и 4 - escape и flush - пропускаются). У din нет
+// размера и PC: слово по выровненному адресу
+template <typename Fn>
+void for_each_trace_record(const MappedFile& file, Fn fn) {
+    if (file.size >= sizeof(TRACE_MAGIC_PACKED) &&
+        memcmp(file.data, TRACE_MAGIC_PACKED, sizeof(TRACE_MAGIC_PACKED)) == 0) {
+        std::vector<uint8_t> block(TRACE_BLOCK_SIZE);
+        size_t pos = sizeof(TRACE_MAGIC_PACKED);
+        while (pos < file.size) {
+            std::string where = " at offset " + std::to_string(pos);
+            if (file.size - pos < TRACE_BLOCK_HEADER) throw std::runtime_error("Truncated trace block" + where);
+            uint32_t header[3];
+            memcpy(header, file.data + pos, TRACE_BLOCK_HEADER);
+            uint32_t raw_size = header[0], stored_size = header[1], count = header[2];
+            pos += TRACE_BLOCK_HEADER;
+            if (raw_size > TRACE_BLOCK_SIZE || stored_size > raw_size || stored_size > file.size - pos) {
+                throw std::runtime_error("Invalid trace block" + where);
             }
-            
-            load_line(set_idx, victim, addr);
-            
-            // Update LRU/pLRU
-            if (use_lru) {
-                sets[set_idx][victim].lru_counter = ++global_counter;
-            } else {
-                update_plru(set_idx, victim);
-            }
-            
-            // Handle write (write-allocate)
-            if (is_write) {
-                sets[set_idx][victim].dirty = true;
-                if (size == 1) sets[set_idx][victim].data[offset] = write_data & 0xFF;
-                else if (size == 2) {
-                    sets[set_idx][victim].data[offset] = write_data & 0xFF;
-                    sets[set_idx][victim].data[offset + 1] = (write_data >> 8) & 0xFF;
-                } else if (size == 4) {
-                    for (int i = 0; i < 4; i++) {
-                        sets[set_idx][victim].data[offset + i] = (write_data >> (i * 8)) & 0xFF;
-                    }
+            const uint8_t* p = file.data + pos;
+            if (stored_size < raw_size) {
+                if (!lz_decompress(p, stored_size, block.data(), raw_size)) {
+                    throw std::runtime_error("Corrupt trace block" + where);
                 }
+                p = block.data();
             }
+            pos += stored_size;
             
-            // Read data
-            uint32_t result = 0;
-            if (size == 1) result = sets[set_idx][victim].data[offset];
-            else if (size == 2) result = sets[set_idx][victim].data[offset] | 
-                                        (sets[set_idx][victim].data[offset + 1] << 8);
-            else if (size == 4) {
-                for (int i = 0; i < 4; i++) {
-                    result |= (sets[set_idx][victim].data[offset + i] << (i * 8));
+            const uint8_t* end = p + raw_size;
+            uint32_t last_addr[3] = {};
+            uint32_t last_pc = 0;
+            for (uint32_t i = 0; i < count; i++) {
+                uint32_t delta = 0, pc_delta = 0;
+                uint8_t tag = p < end ? *p++ : 0xFF;
+                if ((tag & 3) > (uint8_t)AccessType::WRITE || ((tag >> 2) & 3) == 3 || (tag & 0xE0) ||
+                    !get_varint(p, end, delta) || ((tag & TRACE_EXPLICIT_PC) && !get_varint(p, end, pc_delta))) {
+                    throw std::runtime_error("Invalid trace record in block" + where);
                 }
+                TraceRecord r;
+                r.type = (AccessType)(tag & 3);
+                r.size = (uint8_t)(1 << ((tag >> 2) & 3));
+                r.addr = last_addr[tag & 3] += unzigzag(delta);
+                if (tag & TRACE_EXPLICIT_PC) last_pc += unzigzag(pc_delta);
+                else if (r.type == AccessType::INSTR) last_pc = r.addr;
+                r.pc = last_pc;
+                fn(r);
             }
-            return result;
+            if (p != end) throw std::runtime_error("Invalid trace block" + where);
+        }
+        return;
+    }
+    if (file.size >= sizeof(TRACE_MAGIC) && memcmp(file.data, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0) {
+        size_t bytes = file.size - sizeof(TRACE_MAGIC);
+        if (bytes % sizeof(TraceRecord) != 0) throw std::runtime_error("Truncated binary trace");
+        const TraceRecord* records = (const TraceRecord*)(file.data + sizeof(TRACE_MAGIC));
+        size_t count = bytes / sizeof(TraceRecord);
+        for (size_t i = 0; i < count; i++) {
+            __builtin_prefetch(records + i + 32);
+            const TraceRecord& r = records[i];
+            if ((uint8_t)r.type > (uint8_t)AccessType::WRITE || (r.size != 1 && r.size != 2 && r.size != 4)) {
+                throw std::runtime_error("Invalid binary trace record " + std::to_string(i));
+            }
+            // Cache отвергает такие обращения, SweepCache посчитал бы их одним
+            if (r.addr % CACHE_LINE_SIZE + r.size > CACHE_LINE_SIZE) {
+                throw std::runtime_error("Binary trace record " + std::to_string(i) + " crosses a cache line");
+            }
+            fn(r);
         }
+        return;
     }
     
-    void flush() {
-        for (uint32_t s = 0; s < CACHE_SET_COUNT; s++) {
-            for (uint32_t w = 0; w < CACHE_WAY; w++) {
-                if (sets[s][w].valid && sets[s][w].dirty) {
-                    uint32_t addr = (sets[s][w].tag << (CACHE_INDEX_LEN + CACHE_OFFSET_LEN)) | 
-                                   (s << CACHE_OFFSET_LEN);
-                    for (uint32_t i = 0; i < CACHE_LINE_SIZE; i++) {
-                        memory->write8(addr + i, sets[s][w].data[i]);
-                    }
-                }
+    static const AccessType din_types[3] = {AccessType::READ, AccessType::WRITE, AccessType::INSTR};
+    const uint8_t* p = file.data;
+    const uint8_t* end = file.data + file.size;
+    uint64_t line = 0;
+    while (p < end) {
+        line++;
+        const uint8_t* eol = (const uint8_t*)memchr(p, '\n', end - p);
+        if (!eol) eol = end;
+        while (p < eol && (*p == ' ' || *p == '\t')) p++;
+        
+        if (p < eol && *p != '#' && *p != '\r') {
+            uint32_t label = *p++ - '0';
+            if (label > 4 || p == eol || (*p != ' ' && *p != '\t')) {
+                throw std::runtime_error("Invalid din trace line " + std::to_string(line));
+            }
+            while (p < eol && (*p == ' ' || *p == '\t')) p++;
+            if (eol - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) p += 2;
+            
+            // Адрес - не больше 8 hex-цифр, после него в строке только пробелы
+            uint32_t addr = 0;
+            const uint8_t* digits = p;
+            for (int v; p < eol && (v = hex_digit(*p)) >= 0; p++) addr = (addr << 4) | v;
+            size_t count = p - digits;
+            while (p < eol && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+            if (count == 0 || count > 8 || p != eol) {
+                throw std::runtime_error("Invalid din trace line " + std::to_string(line));
             }
+            if (label <= 2) fn(TraceRecord{addr & ~3u, 0, 4, din_types[label]});
         }
+        p = eol + 1;
     }
+}
+
+// Бинарные трассы хранят PC обращения, din - нет
+bool trace_has_pc(const MappedFile& file) {
+    return (file.size >= sizeof(TRACE_MAGIC) && memcmp(file.data, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0) ||
+           (file.size >= sizeof(TRACE_MAGIC_PACKED) &&
+            memcmp(file.data, TRACE_MAGIC_PACKED, sizeof(TRACE_MAGIC_PACKED)) == 0);
+}
+
+// Запись сжатой трассы (--record-trace). record() кодирует в активный буфер
+// в потоке симуляции; заполненный буфер меняется местами с ожидающим, и
+// фоновый поток сжимает и пишет его, пока симуляция заполняет следующий
+class TraceWriter : public TraceSink {
+public:
+    uint64_t records = 0;
+    uint64_t raw_bytes = 0;         // после delta и varint, до сжатия
+    uint64_t file_bytes = 0;        // с магией и заголовками блоков
     
-    void print_detailed_stats() {
-        uint64_t total_data = stats.data_read_access + stats.data_write_access;
-        uint64_t total_data_hit = stats.data_read_hit + stats.data_write_hit;
+    TraceWriter() : active(TRACE_BLOCK_SIZE), pending(TRACE_BLOCK_SIZE) {}
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+    
+    ~TraceWriter() {
+        stop();
+    }
+    
+    void open_file(const std::string& filename) {
+        out.open(filename, std::ios::binary);
+        if (!out) throw std::runtime_error("Cannot create trace: " + filename);
+        path = filename;
+        out.write(TRACE_MAGIC_PACKED, sizeof(TRACE_MAGIC_PACKED));
+        file_bytes = sizeof(TRACE_MAGIC_PACKED);
+        writer = std::thread(&TraceWriter::writer_loop, this);
+    }
+    
+    void record(const TraceRecord& r) override {
+        if (active_size + TRACE_MAX_RECORD > TRACE_BLOCK_SIZE) flush_block();
+        uint8_t* start = active.data() + active_size;
+        uint8_t type = (uint8_t)r.type;
+        uint8_t tag = type | (r.size == 1 ? 0 : r.size == 2 ? 4 : 8);
+        uint32_t predicted_pc = r.type == AccessType::INSTR ? r.addr : last_pc;
+        if (r.pc != predicted_pc) tag |= TRACE_EXPLICIT_PC;
         
-        printf("\n╔════════════════════════════════════════════════════════╗\n");
-        printf("║              Detailed Cache Statistics                ║\n");
-        printf("╠════════════════════════════════════════════════════════╣\n");
-        printf("║ Instructions:                                          ║\n");
-        printf("║   Total: %-12lu Hits: %-12lu Misses: %-6lu ║\n", 
-               stats.instr_access, stats.instr_hit, stats.instr_miss);
-        printf("║ Data Reads:                                            ║\n");
-        printf("║   Total: %-12lu Hits: %-12lu Misses: %-6lu ║\n",
-               stats.data_read_access, stats.data_read_hit, stats.data_read_miss);
-        printf("║ Data Writes:                                           ║\n");
-        printf("║   Total: %-12lu Hits: %-12lu Misses: %-6lu ║\n",
-               stats.data_write_access, stats.data_write_hit, stats.data_write_miss);
-        printf("║ Cache Management:                                      ║\n");
-        printf("║   Evictions: %-12lu Writebacks: %-17lu ║\n",
-               stats.evictions, stats.writebacks);
-        printf("╚════════════════════════════════════════════════════════╝\n");
+        uint8_t* p = start;
+        *p++ = tag;
+        p = put_varint(p, zigzag(r.addr - last_addr[type]));
+        if (tag & TRACE_EXPLICIT_PC) p = put_varint(p, zigzag(r.pc - last_pc));
+        last_addr[type] = r.addr;
+        last_pc = r.pc;
+        active_size += p - start;
+        active_records++;
+        records++;
+        raw_bytes += p - start;
+    }
+    
+    // Последний блок на диск; ошибка записи - исключение
+    void finish() {
+        flush_block();
+        stop();
+        if (failed) throw std::runtime_error("Failed to write trace: " + path);
+    }
+    
+private:
+    std::string path;
+    std::ofstream out;
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable cv;
+    
+    // Активный буфер - только поток симуляции, ожидающий - под mutex
+    std::vector<uint8_t> active, pending;
+    size_t active_size = 0, pending_size = 0;
+    uint32_t active_records = 0, pending_records = 0;
+    bool has_pending = false;
+    bool stopping = false;
+    bool failed = false;
+    uint32_t last_addr[3] = {};
+    uint32_t last_pc = 0;
+    
+    void flush_block() {
+        if (active_records == 0) return;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&]() { return !has_pending; });
+            std::swap(active, pending);
+            pending_size = active_size;
+            pending_records = active_records;
+            has_pending = true;
+        }
+        cv.notify_all();
+        active_size = 0;
+        active_records = 0;
+        memset(last_addr, 0, sizeof(last_addr));
+        last_pc = 0;
+    }
+    
+    void stop() {
+        if (!writer.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        writer.join();
+        out.close();
+        if (out.fail()) failed = true;
+    }
+    
+    void writer_loop() {
+        std::vector<uint8_t> stored(TRACE_BLOCK_SIZE);
+        std::vector<uint32_t> table(LZ_HASH_SIZE);
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [&]() { return has_pending || stopping; });
+            if (!has_pending) return;
+            lock.unlock();
+            
+            // Несжимаемый блок хранится как есть
+            size_t size = lz_compress(pending.data(), pending_size, stored.data(), pending_size, table.data());
+            const uint8_t* data = size ? stored.data() : pending.data();
+            if (!size) size = pending_size;
+            uint32_t header[3] = {(uint32_t)pending_size, (uint32_t)size, pending_records};
+            out.write((const char*)header, sizeof(header));
+            out.write((const char*)data, size);
+            
+            lock.lock();
+            if (!out) failed = true;
+            file_bytes += sizeof(header) + size;
+            has_pending = false;
+            cv.notify_all();
+        }
     }
 };
 
 // ============================================================================
-// RISC-V EMULATOR
+// CACHE (LRU and bit-pLRU)
 // ============================================================================
-class RiscVEmulator {
+class Cache {
 public:
-    uint32_t regs[32];
-    uint32_t pc;
-    Memory memory;
-    Cache* cache;
-    uint32_t initial_ra;
-    bool use_lru;
+    std::string name;
+    uint32_t set_count;
+    uint32_t ways;
+    uint32_t index_len;
+    uint32_t tag_len;
+    uint32_t address_len;           // ADDRESS_LEN; 32 для внешних трасс
+    InclusionPolicy inclusion;
+    WritePolicy write_policy;
+    WriteMissPolicy write_miss;
+    uint32_t hit_latency;
+    uint32_t memory_latency;
+    uint32_t writeback_latency;
+    uint32_t last_latency = 0;      // такты последней операции (включая нижние уровни)
+    bool timing_enabled;
+    bool tag_only;                  // data не выделяется, доступы идут в Memory
+    bool trace_driven;              // tag-only без значений: Memory не читается и не пишется
     
-    RiscVEmulator(bool lru) : use_lru(lru) {
-        memset(regs, 0, sizeof(regs));
-        pc = 0;
-        cache = new Cache(&memory);
+    // Structure of arrays: линия (set, way) имеет индекс set * ways + way
+    // Битовые карты плотные: бит линии = set * ways + way. ways - степень двойки
+    // не больше 64, поэтому биты одного набора всегда лежат в одном слове
+    std::vector<uint32_t> tags;
+    std::vector<uint64_t> valid_bits;
+    std::vector<uint64_t> dirty_bits;
+    std::vector<uint32_t> lru_counters;
+    std::vector<uint8_t> data;          // CACHE_LINE_SIZE байт на линию (пусто в tag-only)
+    uint32_t global_counter = 0;
+    std::vector<uint64_t> plru_bits;    // ways - 1 бит дерева на набор (шаг ways бит)
+    
+    // Счётчики по наборам (индекс - set, как и у plru_bits)
+    struct SetStatistics {
+        uint32_t accesses = 0;
+        uint32_t misses = 0;
+        uint32_t evictions = 0;
+        uint32_t instr_accesses = 0;
+        uint32_t instr_misses = 0;
+    };
+    std::vector<SetStatistics> set_stats;
+    
+    // Фильтр последней линии по потоку (0 - данные, 1 - инструкции): повторное
+    // чтение той же линии решается одним сравнением. Не заполняется, если на
+    // каждое обращение нужны prefetcher, 3C, сектора или отладочный вывод
+    static const uint64_t NO_LINE = 1ull << 32;     // не совпадает ни с одним адресом
+    struct LastLine {
+        uint64_t block_addr = NO_LINE;
+        uint32_t set_idx = 0;
+        uint32_t way = 0;
+    };
+    LastLine last_line[2];
+    
+    // Set sampling: полностью моделируются только отмеченные наборы, остальные
+    // обращения идут прямо в Memory после одной проверки маски
+    bool sampling = false;
+    std::vector<uint64_t> sampled_sets;
+    uint32_t sampled_count = 0;
+    
+    // Секционированные линии (только уровень над памятью): у каждого сектора
+    // свои valid/dirty. Бит линии в valid_bits - тег занят, в dirty_bits -
+    // грязен хотя бы один сектор
+    uint32_t sector_size = CACHE_LINE_SIZE;
+    uint32_t sector_count = 1;
+    std::vector<uint8_t> sector_valid;      // маска секторов по линии
+    std::vector<uint8_t> sector_dirty;
+    
+    // Тепловая карта: промахи набора за каждые heat_interval обращений
+    uint32_t heat_interval = 0;             // 0 - выключена
+    uint64_t heat_clock = 0;
+    std::vector<uint32_t> heat_map;         // интервал-major: heat_map[i * set_count + set]
+    std::vector<uint32_t> heat_last_misses;
+    std::vector<uint64_t> occupancy_hist;   // наборы с k валидными линиями на границах интервалов
+    
+    // Детальная статистика
+    struct Statistics {
+        uint64_t instr_access = 0, instr_hit = 0, instr_miss = 0;
+        uint64_t data_read_access = 0, data_read_hit = 0, data_read_miss = 0;
+        uint64_t data_write_access = 0, data_write_hit = 0, data_write_miss = 0;
+        uint64_t evictions = 0;             // вытеснения валидных линий
+        uint64_t compulsory_misses = 0;     // первое обращение к блоку
+        uint64_t capacity_misses = 0;       // промах и в полностью ассоциативном LRU
+        uint64_t conflict_misses = 0;       // остальные: виноваты отображение и замещение
+        uint64_t writebacks = 0;
+        uint64_t victims_in = 0;            // линии, вытесненные с верхнего уровня
+        uint64_t back_invalidations = 0;    // линии, инвалидированные снизу (inclusive)
+        uint64_t cycles = 0;                // суммарная задержка обращений (для AMAT)
+        uint64_t sector_misses = 0;         // тег совпал, но нужного сектора нет
+        uint64_t fill_bytes = 0;            // прочитано из памяти
+        uint64_t writeback_bytes = 0;       // грязные данные, записанные в память при вытеснении
+        uint64_t walk_access = 0, walk_hit = 0, walk_miss = 0;     // чтения PTE (не входят в data)
+    } stats;
+    
+    MissClassifier* classifier = nullptr;
+    PcProfile* pc_profile = nullptr;    // только L1: data-обращения по PC
+    MshrFile* mshr = nullptr;           // только L1: неблокирующие промахи
+    TraceSink* trace_sink = nullptr;    // только L1: поток обращений (не владеет)
+    
+    // Когерентность приватных L1 (--harts): snooping по общей шине. Состояние
+    // линии задают биты valid/dirty/shared: M - dirty, E - чистая, S - shared,
+    // O - dirty и shared (только MOESI)
+    enum class BusRequest { READ, READ_EXCLUSIVE, UPGRADE, WRITE };
+    enum class SnoopResult { NONE, CLEAN, DIRTY };
+    std::vector<Cache*>* bus = nullptr;     // все L1 на шине, включая этот
+    uint32_t hart = 0;
+    CoherenceProtocol protocol = CoherenceProtocol::MESI;
+    uint32_t transfer_latency = 0;
+    std::vector<uint64_t> shared_bits;
+    std::unordered_map<uint32_t, uint64_t> lost_lines;  // блок -> байты записи, отнявшей его
+    
+    struct CoherenceStatistics {
+        uint64_t invalidations = 0;     // копии, отнятые чужой записью
+        uint64_t upgrades = 0;          // запись в S/O: инвалидация остальных копий
+        uint64_t transfers = 0;         // грязная линия отдана другому L1
+        uint64_t snoop_writebacks = 0;  // грязная линия записана в память по запросу с шины
+        uint64_t coherence_misses = 0;  // промахи по линии, отнятой инвалидацией
+        uint64_t false_sharing = 0;     // из них: чужая запись не задела нужные байты
+    } coh_stats;
+    ReuseDistance* instr_reuse = nullptr;   // только L1: поток инструкций
+    ReuseDistance* data_reuse = nullptr;    // только L1: поток данных
+    
+    Memory* memory;
+    MemoryPort* port;               // под последним уровнем: write buffer и трафик
+    Cache* next_level = nullptr;    // ближе к памяти (L1 -> L2 -> LLC)
+    Cache* prev_level = nullptr;    // ближе к ядру
+    
+    // Prefetching (только L1): заполнения приходят в фоне через prefetch_delay обращений
+    struct PendingPrefetch {
+        uint32_t block_addr;
+        uint64_t ready_at;
+    };
+    Prefetcher* prefetcher = nullptr;
+    uint32_t prefetch_delay = 0;
+    uint32_t prefetch_queue_size = 0;
+    std::deque<PendingPrefetch> prefetch_queue;
+    std::vector<uint64_t> prefetched_bits;      // заполнена prefetch'ем и ещё не использована
+    std::unordered_set<uint32_t> polluted_blocks;   // вытеснены prefetch-заполнением
+    std::vector<uint32_t> prefetch_candidates;
+    uint64_t demand_clock = 0;
+    bool filling_prefetch = false;      // идёт заполнение по prefetch (своему или сверху)
+    
+    // Victim cache (только L1): probe при промахе, обмен линиями при попадании
+    struct VictimEntry {
+        bool valid = false;
+        bool dirty = false;
+        uint32_t block_addr = 0;
+        uint64_t last_use = 0;
+    };
+    std::vector<VictimEntry> victim_entries;
+    std::vector<uint8_t> victim_data;       // CACHE_LINE_SIZE байт на запись (пусто в tag-only)
+    uint64_t victim_clock = 0;
+    uint32_t victim_latency = 0;
+    
+    struct VictimStatistics {
+        uint64_t probes = 0;        // промахи набора, проверенные в буфере
+        uint64_t hits = 0;          // спасённые промахи (обмен линиями)
+        uint64_t inserts = 0;       // линии, вытесненные из наборов в буфер
+        uint64_t writebacks = 0;    // грязные линии, ушедшие из буфера вниз
+    } vc_stats;
+    
+    // Статистика prefetch, отдельно от demand-счётчиков
+    struct PrefetchStatistics {
+        uint64_t issued = 0;        // поставлены в очередь
+        uint64_t redundant = 0;     // блок уже в кэше / в полёте
+        uint64_t dropped = 0;       // очередь переполнена
+        uint64_t filled = 0;        // линии, установленные в кэш
+        uint64_t useful = 0;        // demand-попадание в prefetched линию
+        uint64_t late = 0;          // demand-промах на блок, который ещё в полёте
+        uint64_t useless = 0;       // вытеснены без использования
+        uint64_t pollution = 0;     // demand-промахи на блоки, вытесненные prefetch'ем
+        uint64_t upper_requests = 0;    // нижний уровень: prefetch-заполнения сверху (не demand)
+        uint64_t upper_hits = 0;
+    } pf_stats;
+    
+    Cache(MemoryPort* mem_port, const CacheConfig& config, const SimConfig& sim)
+        : name(config.name), set_count(config.set_count), ways(config.ways),
+          inclusion(config.inclusion), write_policy(config.write_policy),
+          write_miss(config.write_miss), hit_latency(config.hit_latency),
+          memory_latency(sim.latency.memory), writeback_latency(sim.latency.writeback),
+          timing_enabled(sim.latency.enabled), tag_only(sim.tag_only),
+          trace_driven(sim.trace_driven),
+          memory(mem_port->memory), port(mem_port) {
+        if (!is_power_of_two(set_count) || !is_power_of_two(ways) || ways > 64) {
+            throw std::runtime_error("Invalid geometry for cache " + name + ": " +
+                std::to_string(set_count) + " sets x " + std::to_string(ways) + " ways");
+        }
+        index_len = log2_exact(set_count);
+        address_len = trace_driven ? 32 : ADDRESS_LEN;
+        if (index_len + CACHE_OFFSET_LEN >= address_len) {
+            throw std::runtime_error("Cache " + name + " is larger than memory");
+        }
+        tag_len = address_len - index_len - CACHE_OFFSET_LEN;
+        uint32_t bitmap_words = (set_count * ways + 63) / 64;
+        tags.assign(set_count * ways, 0);
+        valid_bits.assign(bitmap_words, 0);
+        dirty_bits.assign(bitmap_words, 0);
+        lru_counters.assign(set_count * ways, 0);
+        if (!tag_only) data.assign((size_t)set_count * ways * CACHE_LINE_SIZE, 0);
+        plru_bits.assign(bitmap_words, 0);
+        set_stats.assign(set_count, SetStatistics());
+        if (sim.classify_misses) classifier = new MissClassifier(set_count * ways);
     }
     
-    ~RiscVEmulator() {
-        delete cache;
+    ~Cache() {
+        delete prefetcher;
+        delete classifier;
+        delete pc_profile;
+        delete mshr;
+        delete instr_reuse;
+        delete data_reuse;
     }
     
-    void check_alignment(uint32_t addr, uint32_t size) {
-        if (addr % size != 0) {
-            if (g_debug) {
-                std::cerr << "Warning: Unaligned access at 0x" << std::hex << addr 
-                          << " (size=" << std::dec << size << ")" << std::endl;
+    void attach_victim_cache(uint32_t entries, uint32_t latency) {
+        victim_entries.assign(entries, VictimEntry());
+        if (!tag_only) victim_data.assign((size_t)entries * CACHE_LINE_SIZE, 0);
+        victim_latency = latency;
+    }
+    
+    void attach_coherence(std::vector<Cache*>* peers, uint32_t hart_id,
+                          CoherenceProtocol coherence, uint32_t latency) {
+        bus = peers;
+        hart = hart_id;
+        protocol = coherence;
+        transfer_latency = latency;
+        shared_bits.assign(valid_bits.size(), 0);
+    }
+    
+    void attach_prefetcher(const PrefetchConfig& config) {
+        prefetcher = make_prefetcher(config);
+        if (!prefetcher) return;
+        prefetch_delay = config.delay;
+        prefetch_queue_size = config.queue_size;
+        prefetched_bits.assign(valid_bits.size(), 0);
+    }
+    
+    uint32_t get_tag(uint32_t addr) {
+        return (addr >> (index_len + CACHE_OFFSET_LEN)) & ((1u << tag_len) - 1);
+    }
+    
+    uint32_t get_index(uint32_t addr) {
+        return (addr >> CACHE_OFFSET_LEN) & ((1 << index_len) - 1);
+    }
+    
+    uint32_t get_offset(uint32_t addr) {
+        return addr & ((1 << CACHE_OFFSET_LEN) - 1);
+    }
+    
+    uint32_t get_block_addr(uint32_t addr) {
+        return addr & ~((1 << CACHE_OFFSET_LEN) - 1);
+    }
+    
+    uint32_t get_line_addr(uint32_t set_idx, uint32_t tag) {
+        return (tag << (index_len + CACHE_OFFSET_LEN)) | (set_idx << CACHE_OFFSET_LEN);
+    }
+    
+    const char* log_tag() {
+        return prev_level ? name.c_str() : "CACHE";
+    }
+    
+    // nullptr в tag-only режиме: все копирования линий пропускаются
+    uint8_t* line_data(uint32_t set_idx, uint32_t way) {
+        if (tag_only) return nullptr;
+        return &data[((size_t)set_idx * ways + way) * CACHE_LINE_SIZE];
+    }
+    
+    void copy_line(uint8_t* dst, const uint8_t* src) {
+        if (dst && src) memcpy(dst, src, CACHE_LINE_SIZE);
+    }
+    
+    uint32_t& line_tag(uint32_t set_idx, uint32_t way) {
+        return tags[set_idx * ways + way];
+    }
+    
+    uint64_t way_mask() {
+        return ways == 64 ? ~0ull : (1ull << ways) - 1;
+    }
+    
+    // Биты набора из плотной битовой карты
+    uint64_t get_set_bits(const std::vector<uint64_t>& bitmap, uint32_t set_idx) {
+        uint32_t bit = set_idx * ways;
+        return (bitmap[bit >> 6] >> (bit & 63)) & way_mask();
+    }
+    
+    void put_set_bits(std::vector<uint64_t>& bitmap, uint32_t set_idx, uint64_t bits) {
+        uint32_t bit = set_idx * ways;
+        uint64_t& word = bitmap[bit >> 6];
+        word = (word & ~(way_mask() << (bit & 63))) | (bits << (bit & 63));
+    }
+    
+    bool test_line_bit(const std::vector<uint64_t>& bitmap, uint32_t set_idx, uint32_t way) {
+        uint32_t bit = set_idx * ways + way;
+        return (bitmap[bit >> 6] >> (bit & 63)) & 1;
+    }
+    
+    void assign_line_bit(std::vector<uint64_t>& bitmap, uint32_t set_idx, uint32_t way, bool value) {
+        uint32_t bit = set_idx * ways + way;
+        if (value) bitmap[bit >> 6] |= 1ull << (bit & 63);
+        else bitmap[bit >> 6] &= ~(1ull << (bit & 63));
+    }
+    
+    bool is_valid(uint32_t set_idx, uint32_t way) {
+        return test_line_bit(valid_bits, set_idx, way);
+    }
+    
+    bool is_dirty(uint32_t set_idx, uint32_t way) {
+        return test_line_bit(dirty_bits, set_idx, way);
+    }
+    
+    void set_valid(uint32_t set_idx, uint32_t way, bool valid) {
+        assign_line_bit(valid_bits, set_idx, way, valid);
+        if (!valid) {
+            if (prefetcher) assign_line_bit(prefetched_bits, set_idx, way, false);
+            for (LastLine& last : last_line) {
+                if (last.set_idx == set_idx && last.way == way) last.block_addr = NO_LINE;
             }
         }
     }
     
-    int32_t sign_extend(uint32_t val, int bits) {
-        if (val & (1 << (bits - 1))) {
-            return val | (~((1 << bits) - 1));
-        }
-        return val;
+    void remember_line(bool is_instruction, uint32_t addr, uint32_t set_idx, uint32_t way) {
+        if (prefetcher || classifier || sectored() || g_debug) return;
+        LastLine& last = last_line[is_instruction];
+        last.block_addr = get_block_addr(addr);
+        last.set_idx = set_idx;
+        last.way = way;
     }
     
-    uint32_t fetch() {
-        if (g_debug) {
-            printf("[FETCH] PC=0x%08X\n", pc);
-        }
-        uint32_t instr = cache->access(pc, false, 0, 4, true, use_lru);
-        return instr;
+    void set_dirty(uint32_t set_idx, uint32_t way, bool dirty) {
+        assign_line_bit(dirty_bits, set_idx, way, dirty);
     }
     
-    void execute(uint32_t instr) {
-        uint32_t opcode = instr & 0x7F;
-        uint32_t rd = (instr >> 7) & 0x1F;
-        uint32_t funct3 = (instr >> 12) & 0x7;
-        uint32_t rs1 = (instr >> 15) & 0x1F;
-        uint32_t rs2 = (instr >> 20) & 0x1F;
-        uint32_t funct7 = (instr >> 25) & 0x7F;
-        
-        regs[0] = 0;
+    int find_way(uint32_t set_idx, uint32_t tag) {
+        uint64_t hits = match_tags(&tags[set_idx * ways], ways, tag) &
+                        get_set_bits(valid_bits, set_idx);
+        return hits ? __builtin_ctzll(hits) : -1;
+    }
+    
+    // Линия покидает уровень: вниз по иерархии (или в память)
+    void send_down(uint32_t block_addr, uint8_t* line, bool dirty, bool use_lru,
+                   uint8_t dirty_sectors = 0xFF) {
+        // Inclusive: верхние уровни теряют копию, грязные данные сверху новее
+        if (inclusion == InclusionPolicy::INCLUSIVE && prev_level) {
+            bool upper_dirty = false;
+            prev_level->back_invalidate(block_addr, line, upper_dirty);
+            if (upper_dirty) {
+                dirty = true;
+                dirty_sectors = 0xFF;       // сверху пришла вся линия
+            }
+        }
         
-        if (g_debug) {
-            printf("[EXEC] PC=0x%08X, instr=0x%08X, opcode=0x%02X\n", pc, instr, opcode);
+        if (next_level) {
+            if (next_level->inclusion == InclusionPolicy::EXCLUSIVE) {
+                next_level->insert_line(block_addr, line, dirty, use_lru);
+                last_latency += next_level->last_latency;
+            } else if (dirty) {
+                next_level->insert_line(block_addr, line, true, use_lru);
+                last_latency += next_level->last_latency;
+            }
         }
         
-        switch (opcode) {
-            case 0x33: { // R-type
-                if (funct7 == 0x00 && funct3 == 0x0) regs[rd] = regs[rs1] + regs[rs2];
-                else if (funct7 == 0x20 && funct3 == 0x0) regs[rd] = regs[rs1] - regs[rs2];
-                else if (funct7 == 0x00 && funct3 == 0x4) regs[rd] = regs[rs1] ^ regs[rs2];
-                else if (funct7 == 0x00 && funct3 == 0x6) regs[rd] = regs[rs1] | regs[rs2];
-                else if (funct7 == 0x00 && funct3 == 0x7) regs[rd] = regs[rs1] & regs[rs2];
-                else if (funct7 == 0x00 && funct3 == 0x1) regs[rd] = regs[rs1] << (regs[rs2] & 0x1F);
-                else if (funct7 == 0x00 && funct3 == 0x5) regs[rd] = regs[rs1] >> (regs[rs2] & 0x1F);
-                else if (funct7 == 0x20 && funct3 == 0x5) regs[rd] = ((int32_t)regs[rs1]) >> (regs[rs2] & 0x1F);
-                else if (funct7 == 0x00 && funct3 == 0x2) regs[rd] = ((int32_t)regs[rs1] < (int32_t)regs[rs2]) ? 1 : 0;
-                else if (funct7 == 0x00 && funct3 == 0x3) regs[rd] = (regs[rs1] < regs[rs2]) ? 1 : 0;
-                else if (funct7 == 0x01 && funct3 == 0x0) regs[rd] = regs[rs1] * regs[rs2];
-                else if (funct7 == 0x01 && funct3 == 0x1) {
-                    int64_t result = (int64_t)(int32_t)regs[rs1] * (int64_t)(int32_t)regs[rs2];
-                    regs[rd] = result >> 32;
-                }
-                else if (funct7 == 0x01 && funct3 == 0x2) {
-                    int64_t result = (int64_t)(int32_t)regs[rs1] * (uint64_t)regs[rs2];
-                    regs[rd] = result >> 32;
-                }
-                else if (funct7 == 0x01 && funct3 == 0x3) {
-                    uint64_t result = (uint64_t)regs[rs1] * (uint64_t)regs[rs2];
-                    regs[rd] = result >> 32;
-                }
-                else if (funct7 == 0x01 && funct3 == 0x4) {
-                    if (regs[rs2] == 0) regs[rd] = -1;
-                    else regs[rd] = (int32_t)regs[rs1] / (int32_t)regs[rs2];
-                }
-                else if (funct7 == 0x01 && funct3 == 0x5) {
-                    if (regs[rs2] == 0) regs[rd] = 0xFFFFFFFF;
-                    else regs[rd] = regs[rs1] / regs[rs2];
-                }
-                else if (funct7 == 0x01 && funct3 == 0x6) {
-                    if (regs[rs2] == 0) regs[rd] = regs[rs1];
-                    else regs[rd] = (int32_t)regs[rs1] % (int32_t)regs[rs2];
-                }
-                else if (funct7 == 0x01 && funct3 == 0x7) {
-                    if (regs[rs2] == 0) regs[rd] = regs[rs1];
-                    else regs[rd] = regs[rs1] % regs[rs2];
-                }
-                pc += 4;
-                break;
+        if (dirty) {
+            stats.writebacks++;
+            if (next_level) last_latency += writeback_latency;
+            else if (sectored()) last_latency += write_sectors(block_addr, line, dirty_sectors & all_sectors());
+            else {
+                last_latency += port->write(block_addr, line, CACHE_LINE_SIZE);
+                stats.writeback_bytes += CACHE_LINE_SIZE;
             }
-            case 0x13: { // I-type
-                int32_t imm = sign_extend((instr >> 20) & 0xFFF, 12);
-                if (funct3 == 0x0) regs[rd] = regs[rs1] + imm;
-                else if (funct3 == 0x4) regs[rd] = regs[rs1] ^ imm;
-                else if (funct3 == 0x6) regs[rd] = regs[rs1] | imm;
-                else if (funct3 == 0x7) regs[rd] = regs[rs1] & imm;
-                else if (funct3 == 0x1) regs[rd] = regs[rs1] << (imm & 0x1F);
-                else if (funct3 == 0x5) {
-                    if ((instr >> 30) & 1) regs[rd] = ((int32_t)regs[rs1]) >> (imm & 0x1F);
-                    else regs[rd] = regs[rs1] >> (imm & 0x1F);
-                }
-                else if (funct3 == 0x2) regs[rd] = ((int32_t)regs[rs1] < imm) ? 1 : 0;
-                else if (funct3 == 0x3) regs[rd] = (regs[rs1] < (uint32_t)imm) ? 1 : 0;
-                pc += 4;
+        }
+    }
+    
+    // Освобождает way: линия уходит в victim cache (если есть) или вниз
+    void evict_line(uint32_t set_idx, uint32_t way_idx, bool use_lru) {
+        if (!is_valid(set_idx, way_idx)) return;
+        
+        uint32_t old_addr = get_line_addr(set_idx, line_tag(set_idx, way_idx));
+        uint8_t* line = line_data(set_idx, way_idx);
+        bool dirty = is_dirty(set_idx, way_idx);
+        uint8_t dirty_sectors = sectored() ? sector_dirty[set_idx * ways + way_idx] : 0xFF;
+        
+        if (prefetcher && test_line_bit(prefetched_bits, set_idx, way_idx)) {
+            assign_line_bit(prefetched_bits, set_idx, way_idx, false);
+            pf_stats.useless++;
+        }
+        
+        stats.evictions++;
+        set_stats[set_idx].evictions++;
+        set_valid(set_idx, way_idx, false);
+        set_dirty(set_idx, way_idx, false);
+        
+        if (!victim_entries.empty()) {
+            victim_insert(old_addr, line, dirty, use_lru);
+        } else {
+            send_down(old_addr, line, dirty, use_lru, dirty_sectors);
+        }
+    }
+    
+    // ------------------------------------------------------------------------
+    // Victim cache: маленький полностью ассоциативный буфер вытесненных линий
+    // ------------------------------------------------------------------------
+    uint8_t* victim_line(uint32_t entry) {
+        if (tag_only) return nullptr;
+        return &victim_data[(size_t)entry * CACHE_LINE_SIZE];
+    }
+    
+    int victim_find(uint32_t block_addr) {
+        for (uint32_t e = 0; e < victim_entries.size(); e++) {
+            if (victim_entries[e].valid && victim_entries[e].block_addr == block_addr) return e;
+        }
+        return -1;
+    }
+    
+    // LRU-запись буфера уходит вниз, на её место - вытесненная из набора линия
+    void victim_insert(uint32_t block_addr, const uint8_t* line, bool dirty, bool use_lru) {
+        uint32_t slot = 0;
+        for (uint32_t e = 0; e < victim_entries.size(); e++) {
+            if (!victim_entries[e].valid) {
+                slot = e;
                 break;
             }
-            case 0x03: { // Load
-                int32_t imm = sign_extend((instr >> 20) & 0xFFF, 12);
-                uint32_t addr = regs[rs1] + imm;
-                if (funct3 == 0x0) {
-                    uint8_t val = cache->access(addr, false, 0, 1, false, use_lru);
-                    regs[rd] = sign_extend(val, 8);
-                } else if (funct3 == 0x1) {
-                    check_alignment(addr, 2);
-                    uint16_t val = cache->access(addr, false, 0, 2, false, use_lru);
-                    regs[rd] = sign_extend(val, 16);
-                } else if (funct3 == 0x2) {
-                    check_alignment(addr, 4);
-                    regs[rd] = cache->access(addr, false, 0, 4, false, use_lru);
-                } else if (funct3 == 0x4) {
-                    regs[rd] = cache->access(addr, false, 0, 1, false, use_lru);
-                } else if (funct3 == 0x5) {
-                    check_alignment(addr, 2);
-                    regs[rd] = cache->access(addr, false, 0, 2, false, use_lru);
+            if (victim_entries[e].last_use < victim_entries[slot].last_use) slot = e;
+        }
+        
+        VictimEntry& entry = victim_entries[slot];
+        if (entry.valid) {
+            if (entry.dirty) vc_stats.writebacks++;
+            send_down(entry.block_addr, victim_line(slot), entry.dirty, use_lru);
+        }
+        
+        entry.valid = true;
+        entry.dirty = dirty;
+        entry.block_addr = block_addr;
+        entry.last_use = ++victim_clock;
+        copy_line(victim_line(slot), line);
+        vc_stats.inserts++;
+    }
+    
+    // Получение линии с нижнего уровня; true, если линия пришла грязной
+    bool fetch_from_below(uint32_t block_addr, uint8_t* out, bool is_instruction, bool use_lru) {
+        if (next_level) {
+            bool dirty = next_level->fetch_line(block_addr, out, is_instruction, use_lru, filling_prefetch);
+            last_latency += next_level->last_latency;
+            return dirty;
+        }
+        port->read(block_addr, out, CACHE_LINE_SIZE);
+        stats.fill_bytes += CACHE_LINE_SIZE;
+        last_latency += memory_latency;
+        return false;
+    }
+    
+    static uint64_t byte_mask(uint32_t offset, uint32_t size) {
+        return ((1ull << size) - 1) << offset;
+    }
+    
+    // Ответ на запрос другого L1 с шины
+    SnoopResult snoop(uint32_t block_addr, BusRequest request, uint8_t* out, uint64_t write_mask) {
+        uint32_t set_idx = get_index(block_addr);
+        int way = find_way(set_idx, get_tag(block_addr));
+        if (way == -1) return SnoopResult::NONE;
+        uint8_t* line = line_data(set_idx, way);
+        bool dirty = is_dirty(set_idx, way);
+        
+        if (dirty && (request == BusRequest::READ || request == BusRequest::READ_EXCLUSIVE)) {
+            if (out && line) copy_line(out, line);
+            coh_stats.transfers++;
+        }
+        if (dirty && (request == BusRequest::WRITE ||
+                      (request == BusRequest::READ && protocol == CoherenceProtocol::MESI))) {
+            // MESI: M -> S через память; запись мимо кэша: сначала вся свежая линия
+            port->write(block_addr, line, CACHE_LINE_SIZE);
+            set_dirty(set_idx, way, false);
+            coh_stats.snoop_writebacks++;
+        }
+        
+        if (request == BusRequest::READ) {
+            assign_line_bit(shared_bits, set_idx, way, true);      // E -> S, M -> O
+        } else {
+            set_dirty(set_idx, way, false);
+            set_valid(set_idx, way, false);
+            lost_lines[block_addr] = write_mask;
+            coh_stats.invalidations++;
+        }
+        return dirty ? SnoopResult::DIRTY : SnoopResult::CLEAN;
+    }
+    
+    // Запрос без данных (upgrade, запись мимо кэша) ко всем остальным L1
+    void broadcast(uint32_t block_addr, BusRequest request, uint64_t write_mask) {
+        for (Cache* peer : *bus) {
+            if (peer != this) peer->snoop(block_addr, request, nullptr, write_mask);
+        }
+    }
+    
+    // Заполнение через шину: грязную копию отдаёт другой L1, иначе - память.
+    // write_mask != 0 - промах записи (read exclusive). Возвращает dirty линии
+    bool bus_fill(uint32_t set_idx, uint32_t way_idx, uint32_t block_addr,
+                  uint64_t write_mask, bool is_instruction, bool use_lru) {
+        BusRequest request = write_mask ? BusRequest::READ_EXCLUSIVE : BusRequest::READ;
+        uint8_t* line = line_data(set_idx, way_idx);
+        bool shared = false, supplied = false;
+        for (Cache* peer : *bus) {
+            if (peer == this) continue;
+            SnoopResult result = peer->snoop(block_addr, request, line, write_mask);
+            if (result != SnoopResult::NONE) shared = true;
+            if (result == SnoopResult::DIRTY) supplied = true;
+        }
+        assign_line_bit(shared_bits, set_idx, way_idx, shared && !write_mask);
+        if (!supplied) return fetch_from_below(block_addr, line, is_instruction, use_lru);
+        
+        // Read: линию в памяти держит MESI-запись или владелец O.
+        // Read exclusive: ответственность за грязные данные переходит сюда
+        last_latency += transfer_latency;
+        return write_mask != 0;
+    }
+    
+    void note_coherence_miss(uint32_t block_addr, uint64_t mask) {
+        auto it = lost_lines.find(block_addr);
+        if (it == lost_lines.end()) return;
+        coh_stats.coherence_misses++;
+        if (!(it->second & mask)) coh_stats.false_sharing++;
+        lost_lines.erase(it);
+    }
+    
+    void load_line(uint32_t set_idx, uint32_t way_idx, uint32_t addr,
+                   bool is_instruction, bool use_lru, uint8_t sectors = 0xFF,
+                   uint64_t write_mask = 0) {
+        uint32_t block_addr = get_block_addr(addr);
+        
+        // Секционированная линия: читаются только запрошенные сектора
+        if (sectored()) {
+            evict_line(set_idx, way_idx, use_lru);
+            sector_valid[set_idx * ways + way_idx] = 0;
+            sector_dirty[set_idx * ways + way_idx] = 0;
+            set_dirty(set_idx, way_idx, false);
+            set_valid(set_idx, way_idx, true);
+            line_tag(set_idx, way_idx) = get_tag(addr);
+            fill_sectors(set_idx, way_idx, block_addr, sectors & all_sectors());
+            return;
+        }
+        
+        // Victim cache: при попадании линии меняются местами, нижний уровень не трогаем.
+        // Probe/hit считаются только для demand-промахов, не для prefetch-заполнений
+        if (!victim_entries.empty()) {
+            if (!filling_prefetch) vc_stats.probes++;
+            int entry = victim_find(block_addr);
+            if (entry != -1) {
+                uint8_t swapped[CACHE_LINE_SIZE];
+                bool dirty = victim_entries[entry].dirty;
+                copy_line(swapped, victim_line(entry));
+                victim_entries[entry].valid = false;
+                
+                evict_line(set_idx, way_idx, use_lru);
+                
+                copy_line(line_data(set_idx, way_idx), swapped);
+                set_dirty(set_idx, way_idx, dirty);
+                set_valid(set_idx, way_idx, true);
+                line_tag(set_idx, way_idx) = get_tag(addr);
+                if (!filling_prefetch) vc_stats.hits++;
+                last_latency += victim_latency;
+                
+                if (g_debug) {
+                    printf("  [%s] VICTIM HIT: addr=0x%08X, set=%u, way=%u\n",
+                           log_tag(), block_addr, set_idx, way_idx);
                 }
-                pc += 4;
-                break;
+                return;
             }
-            case 0x23: { // Store
-                int32_t imm = sign_extend(((instr >> 25) << 5) | rd, 12);
-                uint32_t addr = regs[rs1] + imm;
-                if (funct3 == 0x0) {
-                    cache->access(addr, true, regs[rs2] & 0xFF, 1, false, use_lru);
-                } else if (funct3 == 0x1) {
-                    check_alignment(addr, 2);
-                    cache->access(addr, true, regs[rs2] & 0xFFFF, 2, false, use_lru);
-                } else if (funct3 == 0x2) {
-                    check_alignment(addr, 4);
-                    cache->access(addr, true, regs[rs2], 4, false, use_lru);
+        }
+        
+        // Write back if dirty
+        evict_line(set_idx, way_idx, use_lru);
+        
+        // Load new line
+        bool dirty = bus ? bus_fill(set_idx, way_idx, block_addr, write_mask, is_instruction, use_lru)
+                         : fetch_from_below(block_addr, line_data(set_idx, way_idx), is_instruction, use_lru);
+        set_dirty(set_idx, way_idx, dirty);
+        set_valid(set_idx, way_idx, true);
+        line_tag(set_idx, way_idx) = get_tag(addr);
+        
+        if (g_debug) {
+            printf("  [%s] Loaded line: addr=0x%08X, set=%u, way=%u, tag=0x%02X\n",
+                   log_tag(), block_addr, set_idx, way_idx, get_tag(addr));
+        }
+    }
+    
+    // Запрос линии верхним уровнем при его промахе. Prefetch-заполнения сверху
+    // считаются отдельно: demand-статистика и 3C уровня видят только промахи программы
+    bool fetch_line(uint32_t block_addr, uint8_t* out, bool is_instruction, bool use_lru,
+                    bool prefetch = false) {
+        if (prefetch) {
+            filling_prefetch = true;
+            bool dirty = fetch_prefetched_line(block_addr, out, use_lru);
+            filling_prefetch = false;
+            return dirty;
+        }
+        
+        uint32_t tag = get_tag(block_addr);
+        uint32_t set_idx = get_index(block_addr);
+        last_latency = hit_latency;
+        
+        if (is_instruction) stats.instr_access++;
+        else stats.data_read_access++;
+        set_stats[set_idx].accesses++;
+        if (is_instruction) set_stats[set_idx].instr_accesses++;
+        
+        MissType miss_type = classifier ? classifier->observe(block_addr) : MissType::CONFLICT;
+        int hit_way = find_way(set_idx, tag);
+        if (hit_way != -1) {
+            if (is_instruction) stats.instr_hit++;
+            else stats.data_read_hit++;
+            
+            // Верхнему уровню нужна вся линия
+            if (sectored()) {
+                uint8_t missing = all_sectors() & ~sector_valid[set_idx * ways + hit_way];
+                if (missing) {
+                    stats.sector_misses++;
+                    fill_sectors(set_idx, hit_way, block_addr, missing);
                 }
-                pc += 4;
-                break;
             }
-            case 0x63: { // Branch
-                int32_t imm = sign_extend(
-                    ((instr >> 31) << 12) | (((instr >> 7) & 1) << 11) |
-                    (((instr >> 25) & 0x3F) << 5) | (((instr >> 8) & 0xF) << 1), 13);
-                bool taken = false;
-                if (funct3 == 0x0) taken = (regs[rs1] == regs[rs2]);
-                else if (funct3 == 0x1) taken = (regs[rs1] != regs[rs2]);
-                else if (funct3 == 0x4) taken = ((int32_t)regs[rs1] < (int32_t)regs[rs2]);
-                else if (funct3 == 0x5) taken = ((int32_t)regs[rs1] >= (int32_t)regs[rs2]);
-                else if (funct3 == 0x6) taken = (regs[rs1] < regs[rs2]);
-                else if (funct3 == 0x7) taken = (regs[rs1] >= regs[rs2]);
-                
-                if (taken) pc += imm;
-                else pc += 4;
-                break;
+            stats.cycles += last_latency;
+            
+            copy_line(out, line_data(set_idx, hit_way));
+            
+            // Exclusive: линия переезжает наверх вместе с dirty
+            if (inclusion == InclusionPolicy::EXCLUSIVE) {
+                bool dirty = is_dirty(set_idx, hit_way);
+                set_valid(set_idx, hit_way, false);
+                set_dirty(set_idx, hit_way, false);
+                return dirty;
             }
-            case 0x6F: { // JAL
-                int32_t imm = sign_extend(
-                    ((instr >> 31) << 20) | (((instr >> 12) & 0xFF) << 12) |
-                    (((instr >> 20) & 1) << 11) | (((instr >> 21) & 0x3FF) << 1), 21);
-                regs[rd] = pc + 4;
-                pc += imm;
-                break;
+            touch(set_idx, hit_way, use_lru);
+            return false;
+        }
+        
+        if (is_instruction) stats.instr_miss++;
+        else stats.data_read_miss++;
+        set_stats[set_idx].misses++;
+        if (is_instruction) set_stats[set_idx].instr_misses++;
+        if (classifier) count_miss(miss_type);
+        
+        if (g_debug) {
+            printf("  [%s] MISS: addr=0x%08X, set=%u, %s\n",
+                   log_tag(), block_addr, set_idx, is_instruction ? "INSTR" : "DATA");
+        }
+        
+        // Exclusive уровень не аллоцирует линии при заполнении сверху
+        if (inclusion == InclusionPolicy::EXCLUSIVE) {
+            bool dirty = fetch_from_below(block_addr, out, is_instruction, use_lru);
+            stats.cycles += last_latency;
+            return dirty;
+        }
+        
+        uint32_t victim = use_lru ? find_lru_victim(set_idx) : find_plru_victim(set_idx);
+        load_line(set_idx, victim, block_addr, is_instruction, use_lru);
+        touch(set_idx, victim, use_lru);
+        copy_line(out, line_data(set_idx, victim));
+        stats.cycles += last_latency;
+        return false;
+    }
+    
+    // Тот же путь для prefetch сверху, но без demand-счётчиков, 3C и тактов AMAT
+    bool fetch_prefetched_line(uint32_t block_addr, uint8_t* out, bool use_lru) {
+        uint32_t set_idx = get_index(block_addr);
+        last_latency = hit_latency;
+        pf_stats.upper_requests++;
+        
+        int hit_way = find_way(set_idx, get_tag(block_addr));
+        if (hit_way != -1) {
+            pf_stats.upper_hits++;
+            if (sectored()) {
+                uint8_t missing = all_sectors() & ~sector_valid[set_idx * ways + hit_way];
+                if (missing) fill_sectors(set_idx, hit_way, block_addr, missing);
             }
-            case 0x67: { // JALR
-                int32_t imm = sign_extend((instr >> 20) & 0xFFF, 12);
-                uint32_t target = (regs[rs1] + imm) & ~1;
-                regs[rd] = pc + 4;
-                pc = target;
-                break;
+            copy_line(out, line_data(set_idx, hit_way));
+            if (inclusion == InclusionPolicy::EXCLUSIVE) {
+                bool dirty = is_dirty(set_idx, hit_way);
+                set_valid(set_idx, hit_way, false);
+                set_dirty(set_idx, hit_way, false);
+                return dirty;
             }
-            case 0x37: { // LUI
-                int32_t imm = instr & 0xFFFFF000;
-                regs[rd] = imm;
-                pc += 4;
-                break;
+            touch(set_idx, hit_way, use_lru);
+            return false;
+        }
+        
+        if (inclusion == InclusionPolicy::EXCLUSIVE) {
+            return fetch_from_below(block_addr, out, false, use_lru);
+        }
+        uint32_t victim = use_lru ? find_lru_victim(set_idx) : find_plru_victim(set_idx);
+        load_line(set_idx, victim, block_addr, false, use_lru);
+        touch(set_idx, victim, use_lru);
+        copy_line(out, line_data(set_idx, victim));
+        return false;
+    }
+    
+    // Приём линии, вытесненной с верхнего уровня (буферизуется: платим только
+    // за каскад грязных вытеснений ниже)
+    void insert_line(uint32_t block_addr, const uint8_t* in, bool dirty, bool use_lru) {
+        uint32_t tag = get_tag(block_addr);
+        uint32_t set_idx = get_index(block_addr);
+        last_latency = 0;
+        stats.victims_in++;
+        
+        int way = find_way(set_idx, tag);
+        if (way == -1) {
+            way = use_lru ? find_lru_victim(set_idx) : find_plru_victim(set_idx);
+            evict_line(set_idx, way, use_lru);
+            set_valid(set_idx, way, true);
+            line_tag(set_idx, way) = tag;
+        }
+        
+        copy_line(line_data(set_idx, way), in);
+        if (dirty) set_dirty(set_idx, way, true);
+        if (sectored()) {
+            sector_valid[set_idx * ways + way] = all_sectors();
+            if (dirty) sector_dirty[set_idx * ways + way] = all_sectors();
+        }
+        touch(set_idx, way, use_lru);
+    }
+    
+    // Запись мимо уровня (write-through / no-allocate): вниз или в память
+    void pass_write(uint32_t addr, const uint8_t* bytes, uint32_t size, bool use_lru) {
+        if (next_level) {
+            next_level->absorb_write(addr, bytes, size, use_lru);
+            last_latency += next_level->last_latency;
+        } else {
+            last_latency += port->write(addr, tag_only ? nullptr : bytes, size);
+        }
+    }
+    
+    void write_below(uint32_t addr, uint32_t value, uint32_t size, bool use_lru) {
+        uint8_t bytes[4];
+        for (uint32_t i = 0; i < size; i++) bytes[i] = (value >> (i * 8)) & 0xFF;
+        pass_write(addr, bytes, size, use_lru);
+    }
+    
+    // Сквозная запись сверху: обновляет копию уровня, иначе идёт дальше вниз
+    // (нижние уровни не аллоцируют линии под такие записи)
+    void absorb_write(uint32_t addr, const uint8_t* bytes, uint32_t size, bool use_lru) {
+        uint32_t set_idx = get_index(addr);
+        last_latency = hit_latency;
+        stats.data_write_access++;
+        
+        int way = find_way(set_idx, get_tag(addr));
+        uint8_t sectors = sectored() ? sectors_of(get_offset(addr), size) : 0;
+        if (way != -1 && sectored() && (sectors & ~sector_valid[set_idx * ways + way])) {
+            way = -1;       // сектор не загружен: запись идёт дальше вниз
+        }
+        if (way != -1) {
+            stats.data_write_hit++;
+            if (!tag_only) memcpy(line_data(set_idx, way) + get_offset(addr), bytes, size);
+            set_dirty(set_idx, way, true);
+            if (sectored()) sector_dirty[set_idx * ways + way] |= sectors;
+            touch(set_idx, way, use_lru);
+        } else {
+            stats.data_write_miss++;
+            pass_write(addr, bytes, size, use_lru);
+        }
+        stats.cycles += last_latency;
+    }
+    
+    // Back-invalidation от inclusive уровня снизу (рекурсивно вверх)
+    void back_invalidate(uint32_t block_addr, uint8_t* out, bool& dirty) {
+        uint32_t set_idx = get_index(block_addr);
+        int way = find_way(set_idx, get_tag(block_addr));
+        if (way != -1) {
+            if (is_dirty(set_idx, way)) {
+                copy_line(out, line_data(set_idx, way));
+                dirty = true;
             }
-            case 0x17: { // AUIPC
-                int32_t imm = instr & 0xFFFFF000;
-                regs[rd] = pc + imm;
-                pc += 4;
-                break;
+            set_valid(set_idx, way, false);
+            set_dirty(set_idx, way, false);
+            stats.back_invalidations++;
+            
+            if (g_debug) {
+                printf("  [%s] Back-invalidated: addr=0x%08X, set=%u, way=%d\n",
+                       log_tag(), block_addr, set_idx, way);
             }
-            case 0x73: { // ECALL/EBREAK
-                if (g_debug) printf("[EXEC] ECALL/EBREAK - terminating\n");
-                return;
+        }
+        
+        int entry = victim_find(block_addr);
+        if (entry != -1) {
+            if (victim_entries[entry].dirty) {
+                copy_line(out, victim_line(entry));
+                dirty = true;
+            }
+            victim_entries[entry].valid = false;
+            stats.back_invalidations++;
+        }
+        if (prev_level) prev_level->back_invalidate(block_addr, out, dirty);
+    }
+    
+    // Первая свободная линия набора или -1
+    int find_invalid_way(uint32_t set_idx) {
+        uint64_t invalid = ~get_set_bits(valid_bits, set_idx) & way_mask();
+        return invalid ? __builtin_ctzll(invalid) : -1;
+    }
+    
+    uint32_t find_lru_victim(uint32_t set_idx) {
+        int free_way = find_invalid_way(set_idx);
+        if (free_way != -1) return free_way;
+        
+        const uint32_t* counters = &lru_counters[set_idx * ways];
+        uint32_t victim = 0;
+        uint32_t min_counter = counters[0];
+        
+        for (uint32_t i = 1; i < ways; i++) {
+            if (counters[i] < min_counter) {
+                min_counter = counters[i];
+                victim = i;
+            }
+        }
+        return victim;
+    }
+    
+    uint32_t find_plru_victim(uint32_t set_idx) {
+        // Tree pLRU: node n -> children 2n+1 (left) / 2n+2 (right), bit = 1 -> right
+        // For 4-way: bit0 = root, bit1 = left subtree, bit2 = right subtree
+        uint64_t bits = get_set_bits(plru_bits, set_idx);
+        uint32_t node = 0;
+        
+        while (node < ways - 1) {
+            node = 2 * node + 1 + ((bits >> node) & 1);
+        }
+        uint32_t way = node - (ways - 1);
+        
+        // Check invalid lines first
+        int free_way = find_invalid_way(set_idx);
+        if (free_way != -1) return free_way;
+        
+        return way;
+    }
+    
+    void update_plru(uint32_t set_idx, uint32_t way) {
+        uint64_t bits = get_set_bits(plru_bits, set_idx);
+        uint32_t node = way + ways - 1;
+        
+        // Each node on the path points away from the accessed way
+        while (node > 0) {
+            uint32_t parent = (node - 1) / 2;
+            if (node == 2 * parent + 1) bits |= (1ull << parent);
+            else bits &= ~(1ull << parent);
+            node = parent;
+        }
+        put_set_bits(plru_bits, set_idx, bits);
+    }
+    
+    void touch(uint32_t set_idx, uint32_t way, bool use_lru) {
+        if (use_lru) {
+            lru_counters[set_idx * ways + way] = ++global_counter;
+        } else {
+            update_plru(set_idx, way);
+        }
+    }
+    
+    // Грязные вытеснения этого уровня и всех нижних
+    uint64_t writebacks_below() {
+        return stats.writebacks + (next_level ? next_level->writebacks_below() : 0);
+    }
+    
+    // Блок всегда отображается в один набор L1, поэтому невыбранные блоки никогда
+    // не попадают в иерархию и Memory для них всегда актуальна
+    void enable_sampling(uint32_t every, uint32_t random_count, uint32_t seed) {
+        std::vector<uint32_t> chosen;
+        if (every > 0) {
+            for (uint32_t s = 0; s < set_count; s += every) chosen.push_back(s);
+        } else {
+            for (uint32_t s = 0; s < set_count; s++) chosen.push_back(s);
+            std::mt19937 rng(seed);
+            std::shuffle(chosen.begin(), chosen.end(), rng);
+            chosen.resize(std::min(random_count, set_count));
+        }
+        
+        sampling = true;
+        sampled_sets.assign((set_count + 63) / 64, 0);
+        for (uint32_t s : chosen) sampled_sets[s >> 6] |= 1ull << (s & 63);
+        sampled_count = chosen.size();
+    }
+    
+    bool is_sampled(uint32_t set_idx) {
+        return !sampling || ((sampled_sets[set_idx >> 6] >> (set_idx & 63)) & 1);
+    }
+    
+    void enable_heat_map(uint32_t interval) {
+        heat_interval = interval;
+        heat_last_misses.assign(set_count, 0);
+        occupancy_hist.assign(ways + 1, 0);
+    }
+    
+    // Строка тепловой карты: промахи каждого набора с прошлой границы
+    void close_heat_interval() {
+        for (uint32_t s = 0; s < set_count; s++) {
+            heat_map.push_back(set_stats[s].misses - heat_last_misses[s]);
+            heat_last_misses[s] = set_stats[s].misses;
+            occupancy_hist[__builtin_popcountll(get_set_bits(valid_bits, s))]++;
+        }
+    }
+    
+    uint32_t heat_intervals() {
+        return heat_map.size() / set_count;
+    }
+    
+    // Незакрытый хвост последнего интервала
+    void finish_heat_map() {
+        if (heat_interval && heat_clock > (uint64_t)heat_intervals() * heat_interval) {
+            close_heat_interval();
+        }
+    }
+    
+    void count_miss(MissType type) {
+        if (type == MissType::COMPULSORY) stats.compulsory_misses++;
+        else if (type == MissType::CAPACITY) stats.capacity_misses++;
+        else stats.conflict_misses++;
+    }
+    
+    // Фоновое заполнение линии по prefetch-запросу
+    void prefetch_fill(uint32_t block_addr, bool use_lru) {
+        uint32_t set_idx = get_index(block_addr);
+        if (find_way(set_idx, get_tag(block_addr)) != -1) {
+            pf_stats.redundant++;
+            return;
+        }
+        
+        uint32_t victim = use_lru ? find_lru_victim(set_idx) : find_plru_victim(set_idx);
+        if (is_valid(set_idx, victim)) {
+            polluted_blocks.insert(get_line_addr(set_idx, line_tag(set_idx, victim)));
+        }
+        
+        if (g_debug) {
+            printf("  [CACHE] PREFETCH fill: addr=0x%08X, set=%u, victim_way=%u\n",
+                   block_addr, set_idx, victim);
+        }
+        
+        filling_prefetch = true;
+        load_line(set_idx, victim, block_addr, false, use_lru);
+        filling_prefetch = false;
+        touch(set_idx, victim, use_lru);
+        assign_line_bit(prefetched_bits, set_idx, victim, true);
+        pf_stats.filled++;
+    }
+    
+    void complete_prefetches(bool use_lru) {
+        while (!prefetch_queue.empty() && prefetch_queue.front().ready_at <= demand_clock) {
+            uint32_t block_addr = prefetch_queue.front().block_addr;
+            prefetch_queue.pop_front();
+            prefetch_fill(block_addr, use_lru);
+        }
+    }
+    
+    void issue_prefetches(uint32_t pc, uint32_t addr, bool hit, bool prefetch_hit, bool is_instruction) {
+        prefetch_candidates.clear();
+        prefetcher->train(pc, addr, hit, prefetch_hit, is_instruction, prefetch_candidates);
+        
+        for (uint32_t block_addr : prefetch_candidates) {
+            if ((uint64_t)block_addr + CACHE_LINE_SIZE > 1ull << address_len) continue;
+            if (!is_sampled(get_index(block_addr))) continue;     // набор вне выборки не моделируется
+            
+            bool pending = false;
+            for (const PendingPrefetch& p : prefetch_queue) {
+                if (p.block_addr == block_addr) pending = true;
+            }
+            if (pending || find_way(get_index(block_addr), get_tag(block_addr)) != -1) {
+                pf_stats.redundant++;
+                continue;
+            }
+            if (prefetch_queue.size() >= prefetch_queue_size) {
+                pf_stats.dropped++;
+                continue;
+            }
+            prefetch_queue.push_back({block_addr, demand_clock + prefetch_delay});
+            pf_stats.issued++;
+        }
+    }
+    
+    // Demand-промах: поздний prefetch (блок ещё в полёте) и загрязнение кэша
+    void note_demand_miss(uint32_t block_addr) {
+        for (auto it = prefetch_queue.begin(); it != prefetch_queue.end(); ++it) {
+            if (it->block_addr == block_addr) {
+                prefetch_queue.erase(it);
+                pf_stats.late++;
+                break;
+            }
+        }
+        if (polluted_blocks.erase(block_addr)) pf_stats.pollution++;
+    }
+    
+    void store_to_memory(uint32_t addr, uint32_t write_data, uint32_t size) {
+        if (size == 1) memory->write8(addr, write_data & 0xFF);
+        else if (size == 2) memory->write16(addr, write_data & 0xFFFF);
+        else memory->write32(addr, write_data);
+    }
+    
+    // Чтение/запись слова: из линии кэша или напрямую в Memory (tag-only)
+    uint32_t transfer(uint32_t set_idx, uint32_t way, uint32_t addr,
+                      bool is_write, uint32_t write_data, uint32_t size) {
+        if (is_write && write_policy == WritePolicy::WRITE_BACK) {
+            set_dirty(set_idx, way, true);
+            if (sectored()) sector_dirty[set_idx * ways + way] |= sectors_of(get_offset(addr), size);
+        }
+        
+        if (trace_driven) return 0;
+        if (tag_only) {
+            if (is_write) store_to_memory(addr, write_data, size);
+            if (size == 1) return memory->read8(addr);
+            if (size == 2) return memory->read16(addr);
+            return memory->read32(addr);
+        }
+        
+        uint8_t* line = line_data(set_idx, way);
+        uint32_t offset = get_offset(addr);
+        
+        if (is_write) {
+            if (size == 1) line[offset] = write_data & 0xFF;
+            else if (size == 2) {
+                line[offset] = write_data & 0xFF;
+                line[offset + 1] = (write_data >> 8) & 0xFF;
+            } else if (size == 4) {
+                for (int i = 0; i < 4; i++) {
+                    line[offset + i] = (write_data >> (i * 8)) & 0xFF;
+                }
+            }
+        }
+        
+        // Read data
+        uint32_t result = 0;
+        if (size == 1) result = line[offset];
+        else if (size == 2) result = line[offset] | (line[offset + 1] << 8);
+        else if (size == 4) {
+            for (int i = 0; i < 4; i++) {
+                result |= (line[offset + i] << (i * 8));
+            }
+        }
+        return result;
+    }
+    
+    uint32_t access(uint32_t addr, bool is_write, uint32_t write_data,
+                    uint32_t size, bool is_instruction, bool use_lru, uint32_t pc) {
+        if (trace_sink) {
+            trace_sink->record({addr, pc, (uint8_t)size,
+                                is_instruction ? AccessType::INSTR : is_write ? AccessType::WRITE : AccessType::READ});
+        }
+        if (sampling) {
+            uint32_t set_idx = get_index(addr);
+            if (!((sampled_sets[set_idx >> 6] >> (set_idx & 63)) & 1)) {
+                last_latency = hit_latency;
+                if (trace_driven) return 0;
+                if (is_write) store_to_memory(addr, write_data, size);
+                if (size == 1) return memory->read8(addr);
+                if (size == 2) return memory->read16(addr);
+                return memory->read32(addr);
+            }
+        }
+        if (instr_reuse) {
+            (is_instruction ? instr_reuse : data_reuse)->observe(get_block_addr(addr));
+        }
+        if (!pc_profile || is_instruction) {
+            return access_line(addr, is_write, write_data, size, is_instruction, use_lru, pc);
+        }
+        
+        uint64_t misses = stats.data_read_miss + stats.data_write_miss;
+        uint64_t writebacks = writebacks_below();
+        uint32_t result = access_line(addr, is_write, write_data, size, false, use_lru, pc);
+        pc_profile->record(pc, stats.data_read_miss + stats.data_write_miss == misses,
+                           writebacks_below() - writebacks);
+        return result;
+    }
+    
+    // Чтение PTE при обходе таблиц страниц: проходит через кэш как чтение
+    // данных, но учитывается отдельным видом обращений. Мимо access: профиль
+    // PC и reuse distance видят только обращения самой инструкции
+    uint32_t walk_read(uint32_t addr, bool use_lru, uint32_t pc) {
+        if (!is_sampled(get_index(addr))) {
+            last_latency = hit_latency;
+            return memory->read32(addr);
+        }
+        uint64_t hits = stats.data_read_hit;
+        uint32_t pte = access_line(addr, false, 0, 4, false, use_lru, pc);
+        
+        stats.data_read_access--;
+        stats.walk_access++;
+        if (stats.data_read_hit != hits) {
+            stats.data_read_hit--;
+            stats.walk_hit++;
+        } else {
+            stats.data_read_miss--;
+            stats.walk_miss++;
+        }
+        return pte;
+    }
+    
+    uint32_t access_line(uint32_t addr, bool is_write, uint32_t write_data, 
+                         uint32_t size, bool is_instruction, bool use_lru, uint32_t pc) {
+        // Чтение той же линии, что и прошлое чтение потока: всё обращение целиком в ней
+        const LastLine& last = last_line[is_instruction];
+        if (!is_write && (((uint64_t)addr ^ last.block_addr) |
+                          ((uint64_t)(addr + size - 1) ^ last.block_addr)) < CACHE_LINE_SIZE) {
+            last_latency = hit_latency;
+            if (is_instruction) {
+                stats.instr_access++;
+                stats.instr_hit++;
+                set_stats[last.set_idx].instr_accesses++;
+            } else {
+                stats.data_read_access++;
+                stats.data_read_hit++;
+            }
+            set_stats[last.set_idx].accesses++;
+            if (heat_interval) {
+                if (heat_clock > 0 && heat_clock % heat_interval == 0) close_heat_interval();
+                heat_clock++;
+            }
+            touch(last.set_idx, last.way, use_lru);
+            stats.cycles += last_latency;
+            return transfer(last.set_idx, last.way, addr, false, 0, size);
+        }
+        
+        // Валидация
+        if (size != 1 && size != 2 && size != 4) {
+            throw std::runtime_error("Invalid access size: " + std::to_string(size));
+        }
+        
+        uint32_t offset = get_offset(addr);
+        if (offset + size > CACHE_LINE_SIZE) {
+            throw std::runtime_error("Access crosses cache line boundary at 0x" + 
+                std::to_string(addr));
+        }
+        
+        // Prefetch-заполнения, время которых пришло
+        if (prefetcher) {
+            demand_clock++;
+            complete_prefetches(use_lru);
+        }
+        
+        uint32_t tag = get_tag(addr);
+        uint32_t set_idx = get_index(addr);
+        last_latency = hit_latency;
+        
+        // Update statistics
+        if (is_instruction) {
+            stats.instr_access++;
+        } else {
+            if (is_write) stats.data_write_access++;
+            else stats.data_read_access++;
+        }
+        set_stats[set_idx].accesses++;
+        if (is_instruction) set_stats[set_idx].instr_accesses++;
+        if (heat_interval) {
+            if (heat_clock > 0 && heat_clock % heat_interval == 0) close_heat_interval();
+            heat_clock++;
+        }
+        
+        MissType miss_type = classifier ? classifier->observe(get_block_addr(addr)) : MissType::CONFLICT;
+        
+        // Check for hit
+        int hit_way = find_way(set_idx, tag);
+        
+        // Тег совпал, но сектора нет: промах, который дочитывает сектор без вытеснения
+        bool sector_miss = false;
+        if (hit_way != -1 && sectored()) {
+            uint8_t missing = sectors_of(offset, size) & ~sector_valid[set_idx * ways + hit_way];
+            if (missing) {
+                sector_miss = true;
+                if (is_instruction) stats.instr_miss++;
+                else if (is_write) stats.data_write_miss++;
+                else stats.data_read_miss++;
+                set_stats[set_idx].misses++;
+                if (is_instruction) set_stats[set_idx].instr_misses++;
+                if (classifier) count_miss(miss_type);
+                stats.sector_misses++;
+                
+                if (g_debug) {
+                    printf("  [CACHE] SECTOR MISS: addr=0x%08X, set=%u, way=%d, sectors=0x%02X\n",
+                           addr, set_idx, hit_way, missing);
+                }
+                fill_sectors(set_idx, hit_way, get_block_addr(addr), missing);
+            }
+        }
+        
+        if (hit_way != -1) {
+            // HIT
+            if (sector_miss) {
+                // уже учтён как промах
+            } else if (is_instruction) {
+                stats.instr_hit++;
+            } else {
+                if (is_write) stats.data_write_hit++;
+                else stats.data_read_hit++;
+            }
+            
+            if (g_debug && !sector_miss) {
+                printf("  [CACHE] HIT: addr=0x%08X, set=%u, way=%d, %s%s\n",
+                       addr, set_idx, hit_way, 
+                       is_instruction ? "INSTR" : "DATA",
+                       is_write ? " WRITE" : " READ");
+            }
+            
+            // Update LRU/pLRU
+            touch(set_idx, hit_way, use_lru);
+            
+            // Запись в S/O: остальные копии инвалидируются, линия становится M
+            if (bus && is_write && test_line_bit(shared_bits, set_idx, hit_way)) {
+                broadcast(get_block_addr(addr), BusRequest::UPGRADE, byte_mask(offset, size));
+                assign_line_bit(shared_bits, set_idx, hit_way, false);
+                coh_stats.upgrades++;
+            }
+            
+            // Handle write / read data
+            uint32_t result = transfer(set_idx, hit_way, addr, is_write, write_data, size);
+            if (is_write && write_policy == WritePolicy::WRITE_THROUGH) {
+                write_below(addr, write_data, size, use_lru);
+            }
+            if (is_write && write_miss == WriteMissPolicy::AROUND) {
+                evict_line(set_idx, hit_way, use_lru);
+            }
+            if (!is_write && !sector_miss) remember_line(is_instruction, addr, set_idx, hit_way);
+            stats.cycles += last_latency;
+            
+            if (prefetcher) {
+                bool prefetch_hit = test_line_bit(prefetched_bits, set_idx, hit_way);
+                if (prefetch_hit) {
+                    assign_line_bit(prefetched_bits, set_idx, hit_way, false);
+                    pf_stats.useful++;
+                }
+                issue_prefetches(pc, addr, true, prefetch_hit, is_instruction);
+            }
+            return result;
+        } else {
+            // MISS
+            if (is_instruction) {
+                stats.instr_miss++;
+            } else {
+                if (is_write) stats.data_write_miss++;
+                else stats.data_read_miss++;
+            }
+            set_stats[set_idx].misses++;
+            if (is_instruction) set_stats[set_idx].instr_misses++;
+            if (classifier) count_miss(miss_type);
+            if (bus) note_coherence_miss(get_block_addr(addr), byte_mask(offset, size));
+            
+            // No-allocate: store уходит вниз, линия не загружается (если её нет в victim cache)
+            if (is_write && write_miss != WriteMissPolicy::ALLOCATE &&
+                victim_find(get_block_addr(addr)) == -1) {
+                if (g_debug) {
+                    printf("  [CACHE] MISS: addr=0x%08X, set=%u, DATA WRITE (no allocate)\n",
+                           addr, set_idx);
+                }
+                if (prefetcher) note_demand_miss(get_block_addr(addr));
+                if (bus) broadcast(get_block_addr(addr), BusRequest::WRITE, byte_mask(offset, size));
+                if (tag_only && !trace_driven) store_to_memory(addr, write_data, size);
+                write_below(addr, write_data, size, use_lru);
+                stats.cycles += last_latency;
+                if (prefetcher) issue_prefetches(pc, addr, false, false, is_instruction);
+                return 0;
+            }
+            
+            uint32_t victim = use_lru ? find_lru_victim(set_idx) : find_plru_victim(set_idx);
+            
+            if (g_debug) {
+                printf("  [CACHE] MISS: addr=0x%08X, set=%u, victim_way=%u, %s%s\n",
+                       addr, set_idx, victim,
+                       is_instruction ? "INSTR" : "DATA",
+                       is_write ? " WRITE" : " READ");
+            }
+            
+            if (prefetcher) note_demand_miss(get_block_addr(addr));
+            
+            load_line(set_idx, victim, addr, is_instruction, use_lru, sectors_of(offset, size),
+                      is_write ? byte_mask(offset, size) : 0);
+            
+            // Update LRU/pLRU
+            touch(set_idx, victim, use_lru);
+            
+            // Handle write (write-allocate) / read data
+            uint32_t result = transfer(set_idx, victim, addr, is_write, write_data, size);
+            if (is_write && write_policy == WritePolicy::WRITE_THROUGH) {
+                write_below(addr, write_data, size, use_lru);
+            }
+            if (!is_write) remember_line(is_instruction, addr, set_idx, victim);
+            stats.cycles += last_latency;
+            
+            if (prefetcher) issue_prefetches(pc, addr, false, false, is_instruction);
+            return result;
+        }
+    }
+    
+    // Запись всех грязных линий через порт памяти (трафик учитывается и в
+    // tag-only), затем слив write buffer. Линии остаются валидными и чистыми
+    void flush() {
+        flush_lines();
+        port->drain_all();
+    }
+    
+    // Нижние уровни первыми: данные верхних уровней новее. Блок, грязный выше,
+    // пропускается - его запишет верхний уровень
+    void flush_lines() {
+        if (next_level) next_level->flush_lines();
+        
+        for (uint32_t e = 0; e < victim_entries.size(); e++) {
+            VictimEntry& entry = victim_entries[e];
+            if (entry.valid && entry.dirty && !dirty_above(entry.block_addr)) {
+                port->write(entry.block_addr, victim_line(e), CACHE_LINE_SIZE);
+            }
+            entry.dirty = false;
+        }
+        
+        for (uint32_t s = 0; s < set_count; s++) {
+            uint64_t dirty = get_set_bits(valid_bits, s) & get_set_bits(dirty_bits, s);
+            while (dirty) {
+                uint32_t w = __builtin_ctzll(dirty);
+                dirty &= dirty - 1;
+                set_dirty(s, w, false);
+                uint32_t block_addr = get_line_addr(s, line_tag(s, w));
+                if (dirty_above(block_addr)) continue;
+                uint8_t* line = line_data(s, w);
+                if (!sectored()) {
+                    port->write(block_addr, line, CACHE_LINE_SIZE);
+                    continue;
+                }
+                // Невалидные сектора содержат мусор: пишем только грязные
+                for (uint32_t k = 0; k < sector_count; k++) {
+                    if ((sector_dirty[s * ways + w] >> k) & 1) {
+                        port->write(block_addr + k * sector_size, line ? line + k * sector_size : nullptr,
+                                    sector_size);
+                    }
+                }
+                sector_dirty[s * ways + w] = 0;
+            }
+        }
+    }
+    
+    bool dirty_above(uint32_t block_addr) {
+        for (Cache* c = prev_level; c; c = c->prev_level) {
+            uint32_t set_idx = c->get_index(block_addr);
+            int way = c->find_way(set_idx, c->get_tag(block_addr));
+            if (way != -1 && c->is_dirty(set_idx, way)) return true;
+            int e = c->victim_find(block_addr);
+            if (e != -1 && c->victim_entries[e].dirty) return true;
+        }
+        return false;
+    }
+    
+    // Состояние уровня для checkpoint: геометрия, теги, биты, замещение,
+    // данные, victim cache и статистика. Prefetcher, 3C и профили не сохраняются
+    void save_state(std::ostream& out) {
+        write_pod(out, set_count);
+        write_pod(out, ways);
+        write_pod<uint8_t>(out, tag_only);
+        write_pod<uint8_t>(out, (uint8_t)inclusion);
+        write_vector(out, tags);
+        write_vector(out, valid_bits);
+        write_vector(out, dirty_bits);
+        write_vector(out, lru_counters);
+        write_vector(out, plru_bits);
+        write_pod(out, global_counter);
+        write_vector(out, data);
+        write_vector(out, sector_valid);
+        write_vector(out, sector_dirty);
+        
+        write_pod<uint32_t>(out, victim_entries.size());
+        for (const VictimEntry& e : victim_entries) {
+            write_pod<uint8_t>(out, e.valid);
+            write_pod<uint8_t>(out, e.dirty);
+            write_pod(out, e.block_addr);
+            write_pod(out, e.last_use);
+        }
+        write_vector(out, victim_data);
+        write_pod(out, victim_clock);
+        
+        write_pod(out, stats);
+        write_pod(out, vc_stats);
+        write_vector(out, set_stats);
+    }
+    
+    void load_state(std::istream& in) {
+        for (LastLine& last : last_line) last.block_addr = NO_LINE;
+        uint32_t saved_sets = read_pod<uint32_t>(in);
+        uint32_t saved_ways = read_pod<uint32_t>(in);
+        bool saved_tag_only = read_pod<uint8_t>(in);
+        uint8_t saved_inclusion = read_pod<uint8_t>(in);
+        if (saved_sets != set_count || saved_ways != ways || saved_tag_only != tag_only ||
+            saved_inclusion != (uint8_t)inclusion) {
+            throw std::runtime_error("Checkpoint geometry mismatch for cache " + name + ": saved " +
+                std::to_string(saved_sets) + " sets x " + std::to_string(saved_ways) + " ways");
+        }
+        read_vector(in, tags, "tags");
+        read_vector(in, valid_bits, "valid bits");
+        read_vector(in, dirty_bits, "dirty bits");
+        read_vector(in, lru_counters, "LRU counters");
+        read_vector(in, plru_bits, "pLRU bits");
+        global_counter = read_pod<uint32_t>(in);
+        read_vector(in, data, "line data");
+        read_vector(in, sector_valid, "sector valid bits");
+        read_vector(in, sector_dirty, "sector dirty bits");
+        
+        if (read_pod<uint32_t>(in) != victim_entries.size()) {
+            throw std::runtime_error("Checkpoint mismatch: victim cache size of " + name);
+        }
+        for (VictimEntry& e : victim_entries) {
+            e.valid = read_pod<uint8_t>(in);
+            e.dirty = read_pod<uint8_t>(in);
+            e.block_addr = read_pod<uint32_t>(in);
+            e.last_use = read_pod<uint64_t>(in);
+        }
+        read_vector(in, victim_data, "victim data");
+        victim_clock = read_pod<uint64_t>(in);
+        
+        stats = read_pod<Statistics>(in);
+        vc_stats = read_pod<VictimStatistics>(in);
+        read_vector(in, set_stats, "set statistics");
+    }
+    
+    void enable_sectors(uint32_t size) {
+        if (size != 8 && size != 16 && size != 32) {
+            throw std::runtime_error("Invalid sector size: " + std::to_string(size));
+        }
+        if (next_level || !victim_entries.empty()) {
+            throw std::runtime_error("Sectored lines need the last level without a victim cache");
+        }
+        sector_size = size;
+        sector_count = CACHE_LINE_SIZE / size;
+        sector_valid.assign(set_count * ways, 0);
+        sector_dirty.assign(set_count * ways, 0);
+    }
+    
+    bool sectored() {
+        return sector_count > 1;
+    }
+    
+    uint8_t all_sectors() {
+        return (uint8_t)((1u << sector_count) - 1);
+    }
+    
+    // Сектора, которые задевают байты [offset, offset + size) линии
+    uint8_t sectors_of(uint32_t offset, uint32_t size) {
+        uint32_t first = offset / sector_size;
+        uint32_t last = (offset + size - 1) / sector_size;
+        return (uint8_t)(((1u << (last + 1)) - 1) & ~((1u << first) - 1));
+    }
+    
+    // Дочитывает недостающие сектора из памяти (соседние - одним запросом)
+    void fill_sectors(uint32_t set_idx, uint32_t way, uint32_t block_addr, uint8_t missing) {
+        uint8_t* line = line_data(set_idx, way);
+        uint32_t mask = missing;
+        while (mask) {
+            uint32_t first = __builtin_ctz(mask);
+            uint32_t count = __builtin_ctz(~(mask >> first));
+            uint32_t offset = first * sector_size;
+            port->read(block_addr + offset, line ? line + offset : nullptr, count * sector_size);
+            stats.fill_bytes += count * sector_size;
+            mask &= ~(((1u << count) - 1) << first);
+        }
+        sector_valid[set_idx * ways + way] |= missing;
+        last_latency += memory_latency;
+    }
+    
+    // Запись в память только грязных секторов; возвращает такты
+    uint32_t write_sectors(uint32_t block_addr, const uint8_t* line, uint8_t dirty) {
+        uint32_t latency = 0;
+        uint32_t mask = dirty;
+        while (mask) {
+            uint32_t first = __builtin_ctz(mask);
+            uint32_t count = __builtin_ctz(~(mask >> first));
+            uint32_t offset = first * sector_size;
+            latency += port->write(block_addr + offset, line ? line + offset : nullptr, count * sector_size);
+            stats.writeback_bytes += count * sector_size;
+            mask &= ~(((1u << count) - 1) << first);
+        }
+        return latency;
+    }
+    
+    // Память хоста, занимаемая моделью (теги, состояние, замещение, данные)
+    size_t footprint_bytes() {
+        return tags.size() * sizeof(uint32_t) + lru_counters.size() * sizeof(uint32_t) +
+               (valid_bits.size() + dirty_bits.size() + plru_bits.size() + shared_bits.size()) * sizeof(uint64_t) +
+               sector_valid.size() + sector_dirty.size() + data.size();
+    }
+    
+    void print_detailed_stats() {
+        uint64_t total_data = stats.data_read_access + stats.data_write_access;
+        uint64_t total_data_hit = stats.data_read_hit + stats.data_write_hit;
+        
+        printf("\n╔════════════════════════════════════════════════════════╗\n");
+        printf("║              Detailed Cache Statistics                ║\n");
+        printf("╠════════════════════════════════════════════════════════╣\n");
+        printf("║ Instructions:                                          ║\n");
+        printf("║   Total: %-12lu Hits: %-12lu Misses: %-6lu ║\n", 
+               stats.instr_access, stats.instr_hit, stats.instr_miss);
+        printf("║ Data Reads:                                            ║\n");
+        printf("║   Total: %-12lu Hits: %-12lu Misses: %-6lu ║\n",
+               stats.data_read_access, stats.data_read_hit, stats.data_read_miss);
+        printf("║ Data Writes:                                           ║\n");
+        printf("║   Total: %-12lu Hits: %-12lu Misses: %-6lu ║\n",
+               stats.data_write_access, stats.data_write_hit, stats.data_write_miss);
+        printf("║ Cache Management:                                      ║\n");
+        printf("║   Evictions: %-12lu Writebacks: %-17lu ║\n",
+               stats.evictions, stats.writebacks);
+        printf("║   Model size: %-10lu bytes %-24s ║\n",
+               (unsigned long)footprint_bytes(), tag_only ? "(tag-only)" : "");
+        if (prev_level) {
+            printf("║   Victims in: %-11lu Back-invalidations: %-9lu ║\n",
+                   stats.victims_in, stats.back_invalidations);
+        }
+        if (pf_stats.upper_requests) {
+            printf("║   Prefetch fills from above: %-7lu Hits: %-12lu ║\n",
+                   pf_stats.upper_requests, pf_stats.upper_hits);
+        }
+        if (classifier) {
+            printf("║ Misses (3C):                                           ║\n");
+            printf("║   Compulsory: %-6lu Capacity: %-6lu Conflict: %-6lu ║\n",
+                   stats.compulsory_misses, stats.capacity_misses, stats.conflict_misses);
+        }
+        if (timing_enabled) {
+            uint64_t total = stats.instr_access + stats.data_read_access + stats.data_write_access;
+            printf("║ Timing:                                                ║\n");
+            printf("║   Cycles: %-14lu AMAT: %-24.4f ║\n",
+                   stats.cycles, total ? (double)stats.cycles / total : 0.0);
+        }
+        printf("╚════════════════════════════════════════════════════════╝\n");
+    }
+};
+
+// ============================================================================
+// MMU (SV32)
+// ============================================================================
+const uint32_t PAGE_SIZE = 4096;
+const uint32_t PTE_V = 1 << 0, PTE_R = 1 << 1, PTE_W = 1 << 2, PTE_X = 1 << 3;
+const uint32_t PTE_A = 1 << 6, PTE_D = 1 << 7;
+
+class Tlb {
+public:
+    struct Entry {
+        bool valid = false;
+        uint8_t flags = 0;          // R/W/X/A/D листового PTE
+        uint8_t level = 0;          // 1 - мегастраница: vpn - это VPN[1], ppn выровнен на 4 MiB
+        uint32_t vpn = 0;
+        uint32_t ppn = 0;
+        uint32_t stamp = 0;         // LRU - последнее обращение, FIFO - заполнение
+    };
+    
+    std::string name;
+    uint32_t sets;
+    uint32_t ways;
+    TlbPolicy policy;
+    std::vector<Entry> entries;
+    
+    struct Statistics {
+        uint64_t accesses = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+    } stats;
+    
+    Tlb(const std::string& tlb_name, const TlbConfig& config)
+        : name(tlb_name), ways(config.ways), policy(config.policy) {
+        if (config.ways == 0 || config.entries % config.ways != 0 ||
+            !is_power_of_two(config.entries / config.ways)) {
+            throw std::runtime_error("Invalid " + name + " geometry: " + std::to_string(config.entries) +
+                                     " entries, " + std::to_string(config.ways) + " ways");
+        }
+        sets = config.entries / config.ways;
+        entries.assign(config.entries, Entry());
+    }
+    
+    // Запись 4 KiB страницы ищется в наборе по VPN, мегастраницы - по VPN[1]
+    Entry* lookup(uint32_t va) {
+        stats.accesses++;
+        for (uint8_t level = 0; level < 2; level++) {
+            uint32_t vpn = va >> (12 + 10 * level);
+            Entry* set = &entries[(vpn & (sets - 1)) * ways];
+            for (uint32_t w = 0; w < ways; w++) {
+                if (set[w].valid && set[w].level == level && set[w].vpn == vpn) {
+                    stats.hits++;
+                    if (policy == TlbPolicy::LRU) set[w].stamp = ++clock;
+                    return &set[w];
+                }
+            }
+        }
+        stats.misses++;
+        return nullptr;
+    }
+    
+    void insert(uint32_t va, uint8_t level, uint32_t ppn, uint8_t flags) {
+        uint32_t vpn = va >> (12 + 10 * level);
+        Entry* set = &entries[(vpn & (sets - 1)) * ways];
+        Entry* victim = nullptr;
+        for (uint32_t w = 0; w < ways && !victim; w++) {
+            if (!set[w].valid) victim = &set[w];
+        }
+        if (!victim) {
+            stats.evictions++;
+            if (policy == TlbPolicy::RANDOM) {
+                random_state ^= random_state << 13;
+                random_state ^= random_state >> 17;
+                random_state ^= random_state << 5;
+                victim = &set[random_state % ways];
+            } else {
+                victim = set;
+                for (uint32_t w = 1; w < ways; w++) {
+                    if (set[w].stamp < victim->stamp) victim = &set[w];
+                }
+            }
+        }
+        victim->valid = true;
+        victim->level = level;
+        victim->vpn = vpn;
+        victim->ppn = ppn;
+        victim->flags = flags;
+        victim->stamp = ++clock;
+    }
+    
+    // Память, покрытая валидными записями: 4 KiB или 4 MiB на запись
+    uint64_t reach() const {
+        uint64_t bytes = 0;
+        for (const Entry& e : entries) {
+            if (e.valid) bytes += (uint64_t)PAGE_SIZE << (10 * e.level);
+        }
+        return bytes;
+    }
+    
+    void save_state(std::ostream& out) {
+        write_pod(out, sets);
+        write_pod(out, ways);
+        write_vector(out, entries);
+        write_pod(out, clock);
+        write_pod(out, random_state);
+        write_pod(out, stats);
+    }
+    
+    void load_state(std::istream& in) {
+        if (read_pod<uint32_t>(in) != sets || read_pod<uint32_t>(in) != ways) {
+            throw std::runtime_error("Checkpoint geometry mismatch for " + name);
+        }
+        read_vector(in, entries, "TLB entries");
+        clock = read_pod<uint32_t>(in);
+        random_state = read_pod<uint32_t>(in);
+        stats = read_pod<Statistics>(in);
+    }
+    
+private:
+    uint32_t clock = 0;
+    uint32_t random_state = 1;      // xorshift32 для RANDOM
+};
+
+// Трансляция Sv32: промах TLB обходит двухуровневую таблицу, читая PTE через
+// L1 (Cache::walk_read). A и D аппаратно не выставляются: их отсутствие -
+// page fault, как без расширения Svadu. Ловушек нет, page fault завершает прогон
+class Mmu {
+public:
+    uint32_t root;                  // физический адрес корневой таблицы
+    PageMapping mapping;
+    Tlb itlb;
+    Tlb dtlb;
+    uint32_t last_latency = 0;      // такты обхода таблиц в последней трансляции
+    
+    struct Statistics {
+        uint64_t walks = 0;
+        uint64_t pte_reads = 0;
+        uint64_t megapages = 0;     // обходы, закончившиеся на 4 MiB странице
+        uint64_t walk_cycles = 0;
+    } stats;
+    
+    Mmu(const SimConfig& config)
+        : root(config.page_table_root), mapping(config.page_mapping),
+          itlb("I-TLB", config.itlb), dtlb("D-TLB", config.dtlb) {
+        if (root % PAGE_SIZE != 0 || root > MEMORY_SIZE - PAGE_SIZE) {
+            throw std::runtime_error("Invalid page table root: " + std::to_string(root));
+        }
+    }
+    
+    // Тождественное отображение всей памяти: корневая таблица и под ней
+    // таблица 4 KiB страниц (IDENTITY) или одна мегастраница (IDENTITY_MEGA)
+    void build_page_tables(Memory& memory) {
+        const uint32_t leaf = PTE_V | PTE_R | PTE_W | PTE_X | PTE_A | PTE_D;
+        if (mapping == PageMapping::IDENTITY_MEGA) {
+            memory.write32(root, leaf);
+            return;
+        }
+        if (root + 2 * PAGE_SIZE > MEMORY_SIZE) {
+            throw std::runtime_error("No room for the identity page table after root");
+        }
+        uint32_t table = root + PAGE_SIZE;
+        memory.write32(root, ((table / PAGE_SIZE) << 10) | PTE_V);
+        for (uint32_t page = 0; page < MEMORY_SIZE / PAGE_SIZE; page++) {
+            memory.write32(table + page * 4, (page << 10) | leaf);
+        }
+    }
+    
+    uint32_t translate(uint32_t va, bool is_fetch, bool is_write, Cache* cache, bool use_lru, uint32_t pc) {
+        last_latency = 0;
+        Tlb& tlb = is_fetch ? itlb : dtlb;
+        uint32_t ppn;
+        uint8_t level;
+        uint8_t flags;
+        
+        Tlb::Entry* entry = tlb.lookup(va);
+        if (entry) {
+            ppn = entry->ppn;
+            level = entry->level;
+            flags = entry->flags;
+        } else {
+            walk(va, cache, use_lru, pc, ppn, level, flags);
+            tlb.insert(va, level, ppn, flags);
+        }
+        // Мегастраница больше физической памяти: проверяется каждая 4 KiB часть
+        if (level == 1) {
+            ppn |= (va >> 12) & 0x3FF;
+            if (ppn >= MEMORY_SIZE / PAGE_SIZE) fault(va, "page outside physical memory");
+        }
+        
+        uint32_t needed = is_fetch ? PTE_X : is_write ? (PTE_W | PTE_D) : PTE_R;
+        if ((flags & (needed | PTE_A)) != (needed | PTE_A)) {
+            fault(va, is_fetch ? "fetch not permitted" : is_write ? "store not permitted" : "load not permitted");
+        }
+        return ppn * PAGE_SIZE + va % PAGE_SIZE;
+    }
+    
+    // Трансляция для отчётов: обход таблиц прямо по Memory, мимо кэша и TLB
+    // и без статистики; false - адрес не отображён
+    bool peek(uint32_t va, Memory& memory, uint32_t& pa) {
+        uint32_t table = root;
+        for (int level = 1; level >= 0; level--) {
+            uint32_t pte = memory.read32(table + ((va >> (12 + 10 * level)) & 0x3FF) * 4);
+            if (!(pte & PTE_V) || (!(pte & PTE_R) && (pte & PTE_W))) return false;
+            uint32_t next_ppn = pte >> 10;
+            if (pte & (PTE_R | PTE_X)) {
+                if (level == 1) {
+                    if (next_ppn & 0x3FF) return false;
+                    next_ppn |= (va >> 12) & 0x3FF;
+                }
+                if (next_ppn >= MEMORY_SIZE / PAGE_SIZE) return false;
+                pa = next_ppn * PAGE_SIZE + va % PAGE_SIZE;
+                return true;
+            }
+            if (next_ppn >= MEMORY_SIZE / PAGE_SIZE) return false;
+            table = next_ppn * PAGE_SIZE;
+        }
+        return false;
+    }
+    
+    void save_state(std::ostream& out) {
+        write_pod(out, root);
+        itlb.save_state(out);
+        dtlb.save_state(out);
+        write_pod(out, stats);
+    }
+    
+    void load_state(std::istream& in) {
+        if (read_pod<uint32_t>(in) != root) {
+            throw std::runtime_error("Checkpoint page table root mismatch");
+        }
+        itlb.load_state(in);
+        dtlb.load_state(in);
+        stats = read_pod<Statistics>(in);
+    }
+    
+private:
+    [[noreturn]] void fault(uint32_t va, const char* reason) {
+        char message[96];
+        snprintf(message, sizeof(message), "Page fault at 0x%08X: %s", va, reason);
+        throw std::runtime_error(message);
+    }
+    
+    // Лист: ppn и уровень (1 - мегастраница, ppn её начала)
+    void walk(uint32_t va, Cache* cache, bool use_lru, uint32_t pc, uint32_t& ppn, uint8_t& leaf_level,
+              uint8_t& flags) {
+        stats.walks++;
+        uint32_t table = root;
+        for (int level = 1; level >= 0; level--) {
+            uint32_t pte_addr = table + ((va >> (12 + 10 * level)) & 0x3FF) * 4;
+            uint32_t pte = cache->walk_read(pte_addr, use_lru, pc);
+            last_latency += cache->last_latency;
+            stats.pte_reads++;
+            
+            if (!(pte & PTE_V) || (!(pte & PTE_R) && (pte & PTE_W))) fault(va, "invalid PTE");
+            uint32_t next_ppn = pte >> 10;
+            if (pte & (PTE_R | PTE_X)) {
+                if (level == 1) {
+                    if (next_ppn & 0x3FF) fault(va, "misaligned megapage");
+                    stats.megapages++;
+                } else if (next_ppn >= MEMORY_SIZE / PAGE_SIZE) {
+                    fault(va, "page outside physical memory");
+                }
+                ppn = next_ppn;
+                leaf_level = level;
+                flags = pte & 0xFF;
+                stats.walk_cycles += last_latency;
+                return;
+            }
+            if (next_ppn >= MEMORY_SIZE / PAGE_SIZE) fault(va, "page table outside physical memory");
+            table = next_ppn * PAGE_SIZE;
+        }
+        fault(va, "no leaf PTE");
+    }
+};
+
+// ============================================================================
+// BRANCH PREDICTION
+// ============================================================================
+class BranchPredictor {
+public:
+    virtual ~BranchPredictor() {}
+    virtual const char* name() = 0;
+    
+    // Направление условного перехода; target - адрес при переходе
+    virtual bool predict(uint32_t pc, uint32_t target) = 0;
+    // Обучение исходом перехода, для которого только что вызван predict
+    virtual void update(uint32_t pc, bool taken) = 0;
+};
+
+// Backward taken, forward not taken: циклы угадываются без таблиц
+class StaticPredictor : public BranchPredictor {
+public:
+    const char* name() override { return "static"; }
+    bool predict(uint32_t pc, uint32_t target) override { return target < pc; }
+    void update(uint32_t, bool) override {}
+};
+
+// 2-битные насыщающиеся счётчики по PC
+class BimodalPredictor : public BranchPredictor {
+    std::vector<uint8_t> counters;
+    
+public:
+    BimodalPredictor(uint32_t index_bits) : counters(1u << index_bits, 1) {}
+    
+    const char* name() override { return "bimodal"; }
+    
+    bool predict(uint32_t pc, uint32_t) override {
+        return counters[(pc >> 2) & (counters.size() - 1)] >= 2;
+    }
+    
+    void update(uint32_t pc, bool taken) override {
+        uint8_t& c = counters[(pc >> 2) & (counters.size() - 1)];
+        if (taken && c < 3) c++;
+        if (!taken && c > 0) c--;
+    }
+};
+
+// Счётчики по PC XOR глобальная история
+class GsharePredictor : public BranchPredictor {
+    std::vector<uint8_t> counters;
+    uint32_t history = 0;
+    uint32_t history_mask;
+    
+    uint32_t index(uint32_t pc) {
+        return ((pc >> 2) ^ history) & (counters.size() - 1);
+    }
+    
+public:
+    GsharePredictor(uint32_t index_bits, uint32_t history_bits)
+        : counters(1u << index_bits, 1), history_mask((1u << history_bits) - 1) {}
+    
+    const char* name() override { return "gshare"; }
+    
+    bool predict(uint32_t pc, uint32_t) override {
+        return counters[index(pc)] >= 2;
+    }
+    
+    void update(uint32_t pc, bool taken) override {
+        uint8_t& c = counters[index(pc)];
+        if (taken && c < 3) c++;
+        if (!taken && c > 0) c--;
+        history = ((history << 1) | taken) & history_mask;
+    }
+};
+
+// TAGE-lite: bimodal-основа и тегированные таблицы с геометрически растущей
+// длиной истории. Предсказывает самая длинная совпавшая таблица (provider);
+// при ошибке запись выделяется в более длинной таблице с useful == 0
+class TagePredictor : public BranchPredictor {
+    static const int TABLES = 4;
+    const uint32_t HISTORY[TABLES] = {4, 10, 24, 60};
+    
+    struct Entry {
+        int8_t counter = 0;         // -4..3, >= 0 - переход
+        uint8_t tag = 0;
+        uint8_t useful = 0;         // 0..3
+        bool valid = false;         // не выделенная запись не совпадает ни с каким тегом
+    };
+    std::vector<uint8_t> base;
+    std::vector<Entry> tables[TABLES];
+    uint32_t index_bits;
+    uint64_t history = 0;
+    uint64_t updates = 0;
+    
+    // Состояние последнего predict
+    uint32_t indices[TABLES];
+    uint8_t tags[TABLES];
+    int provider = -1;
+    bool provider_taken = false;
+    bool alternate_taken = false;
+    
+    // Свёртка history[0, length) в bits бит
+    static uint32_t fold(uint64_t value, uint32_t length, uint32_t bits) {
+        if (length < 64) value &= (1ull << length) - 1;
+        uint32_t result = 0;
+        for (; value; value >>= bits) result ^= value & ((1u << bits) - 1);
+        return result;
+    }
+    
+public:
+    TagePredictor(uint32_t bits) : base(1u << bits, 1), index_bits(bits) {
+        for (std::vector<Entry>& t : tables) t.assign(1u << bits, Entry());
+    }
+    
+    const char* name() override { return "tage"; }
+    
+    bool predict(uint32_t pc, uint32_t) override {
+        uint32_t mask = (1u << index_bits) - 1;
+        uint32_t word = pc >> 2;
+        provider = -1;
+        int alternate = -1;
+        for (int t = TABLES - 1; t >= 0; t--) {
+            indices[t] = (word ^ (word >> index_bits) ^ fold(history, HISTORY[t], index_bits)) & mask;
+            tags[t] = (word ^ (fold(history, HISTORY[t], 8) << 1) ^ fold(history, HISTORY[t], 7)) & 0xFF;
+            const Entry& e = tables[t][indices[t]];
+            if (!e.valid || e.tag != tags[t]) continue;
+            if (provider < 0) provider = t;
+            else if (alternate < 0) alternate = t;
+        }
+        
+        bool base_taken = base[word & (base.size() - 1)] >= 2;
+        alternate_taken = alternate >= 0 ? tables[alternate][indices[alternate]].counter >= 0 : base_taken;
+        provider_taken = provider >= 0 ? tables[provider][indices[provider]].counter >= 0 : base_taken;
+        return provider_taken;
+    }
+    
+    void update(uint32_t pc, bool taken) override {
+        if (provider >= 0) {
+            Entry& e = tables[provider][indices[provider]];
+            if (provider_taken != alternate_taken) {
+                if (provider_taken == taken && e.useful < 3) e.useful++;
+                if (provider_taken != taken && e.useful > 0) e.useful--;
+            }
+            if (taken && e.counter < 3) e.counter++;
+            if (!taken && e.counter > -4) e.counter--;
+        } else {
+            uint8_t& c = base[(pc >> 2) & (base.size() - 1)];
+            if (taken && c < 3) c++;
+            if (!taken && c > 0) c--;
+        }
+        
+        if (provider_taken != taken) {
+            bool allocated = false;
+            for (int t = provider + 1; t < TABLES && !allocated; t++) {
+                Entry& e = tables[t][indices[t]];
+                if (e.useful != 0) continue;
+                e.counter = taken ? 0 : -1;
+                e.tag = tags[t];
+                e.valid = true;
+                allocated = true;
+            }
+            for (int t = provider + 1; t < TABLES && !allocated; t++) {
+                if (tables[t][indices[t]].useful > 0) tables[t][indices[t]].useful--;
+            }
+        }
+        
+        // Старение useful, чтобы таблицы не застывали
+        if (++updates % 65536 == 0) {
+            for (std::vector<Entry>& table : tables) {
+                for (Entry& e : table) e.useful >>= 1;
+            }
+        }
+        history = (history << 1) | taken;
+    }
+};
+
+BranchPredictor* make_branch_predictor(PredictorType type, const BranchConfig& config) {
+    switch (type) {
+        case PredictorType::STATIC: return new StaticPredictor();
+        case PredictorType::BIMODAL: return new BimodalPredictor(config.table_bits);
+        case PredictorType::GSHARE: return new GsharePredictor(config.table_bits, config.history_bits);
+        case PredictorType::TAGE: return new TagePredictor(config.table_bits);
+    }
+    return nullptr;
+}
+
+// Переходы в конвейере: направление условных - от предикторов, цели - из BTB,
+// возвраты - из RAS (ra/t0 по соглашению RISC-V). Функционально переход
+// уже выполнен; здесь только проверка, угадала бы его выборка
+class BranchUnit {
+public:
+    struct BtbEntry {
+        bool valid = false;
+        uint32_t pc = 0;
+        uint32_t target = 0;
+    };
+    
+    // Условный переход по PC (для основного предиктора)
+    struct Site {
+        uint32_t pc = 0;
+        uint64_t executions = 0;
+        uint64_t taken = 0;
+        uint64_t mispredicts = 0;
+    };
+    
+    struct PredictorStatistics {
+        uint64_t mispredicts = 0;   // неверное направление
+        uint64_t redirects = 0;     // все перенаправления выборки с этим предиктором
+    };
+    
+    struct Statistics {
+        uint64_t branches = 0;      // условные
+        uint64_t taken = 0;
+        uint64_t jumps = 0;         // jal/jalr, кроме возвратов
+        uint64_t returns = 0;
+        uint64_t btb_lookups = 0;
+        uint64_t btb_hits = 0;      // цель в BTB верна
+        uint64_t ras_hits = 0;
+        uint64_t ras_overflows = 0;
+    } stats;
+    
+    std::vector<BranchPredictor*> predictors;
+    std::vector<PredictorStatistics> predictor_stats;
+    std::vector<BtbEntry> btb;
+    std::vector<uint32_t> ras;
+    uint32_t ras_capacity;
+    std::unordered_map<uint32_t, Site> sites;
+    uint32_t penalty;
+    
+    BranchUnit(const BranchConfig& config, uint32_t mispredict_penalty)
+        : btb(config.btb_entries), penalty(mispredict_penalty) {
+        if (!is_power_of_two(config.btb_entries)) {
+            throw std::runtime_error("BTB entries must be a power of two: " + std::to_string(config.btb_entries));
+        }
+        for (PredictorType type : config.predictors) {
+            predictors.push_back(make_branch_predictor(type, config));
+        }
+        predictor_stats.assign(predictors.size(), PredictorStatistics());
+        ras_capacity = config.ras_entries;
+    }
+    
+    ~BranchUnit() {
+        for (BranchPredictor* p : predictors) delete p;
+    }
+    
+    // Переход, исполненный по pc (следующий pc - next_pc); возвращает такты
+    // штрафа основного предиктора
+    uint32_t resolve(uint32_t instr, uint32_t pc, uint32_t next_pc) {
+        uint32_t opcode = instr & 0x7F;
+        uint64_t redirects = predictor_stats[0].redirects;
+        
+        if (opcode == 0x63) {
+            int32_t offset = ((int32_t)(instr & 0x80000000) >> 19) | ((instr & 0x80) << 4) |
+                             ((instr >> 20) & 0x7E0) | ((instr >> 7) & 0x1E);
+            uint32_t target = pc + offset;
+            bool taken = next_pc == target && target != pc + 4;
+            bool target_known = taken && btb_predicts(pc, target);
+            if (taken) btb_update(pc, target);
+            
+            stats.branches++;
+            if (taken) stats.taken++;
+            for (size_t p = 0; p < predictors.size(); p++) {
+                bool predicted = predictors[p]->predict(pc, target);
+                predictors[p]->update(pc, taken);
+                if (predicted != taken) predictor_stats[p].mispredicts++;
+                // Угаданный переход без цели в BTB тоже перенаправляет выборку
+                if (predicted != taken || (taken && !target_known)) predictor_stats[p].redirects++;
+                if (p == 0) record_site(pc, taken, predicted != taken);
+            }
+        } else if (opcode == 0x6F || opcode == 0x67) {
+            uint32_t rd = (instr >> 7) & 0x1F;
+            uint32_t rs1 = (instr >> 15) & 0x1F;
+            bool link_rd = rd == 1 || rd == 5;
+            bool link_rs1 = opcode == 0x67 && (rs1 == 1 || rs1 == 5);
+            
+            bool correct;
+            if (link_rs1 && !link_rd) {
+                stats.returns++;
+                correct = !ras.empty() && ras.back() == next_pc;
+                if (correct) stats.ras_hits++;
+                if (!ras.empty()) ras.pop_back();
+            } else {
+                stats.jumps++;
+                correct = btb_predicts(pc, next_pc);
+                btb_update(pc, next_pc);
+            }
+            if (link_rd && ras_capacity > 0) {
+                if (ras.size() == ras_capacity) {
+                    ras.erase(ras.begin());
+                    stats.ras_overflows++;
+                }
+                ras.push_back(pc + 4);
+            }
+            if (!correct) {
+                for (PredictorStatistics& ps : predictor_stats) ps.redirects++;
+            }
+        }
+        return (predictor_stats[0].redirects - redirects) * penalty;
+    }
+    
+    // Худшие условные переходы по числу промахов
+    std::vector<Site> top(uint32_t count) const {
+        std::vector<Site> result;
+        for (const auto& kv : sites) result.push_back(kv.second);
+        std::sort(result.begin(), result.end(), [](const Site& a, const Site& b) {
+            if (a.mispredicts != b.mispredicts) return a.mispredicts > b.mispredicts;
+            if (a.executions != b.executions) return a.executions > b.executions;
+            return a.pc < b.pc;
+        });
+        if (result.size() > count) result.resize(count);
+        return result;
+    }
+    
+private:
+    bool btb_predicts(uint32_t pc, uint32_t target) {
+        const BtbEntry& e = btb[(pc >> 2) & (btb.size() - 1)];
+        stats.btb_lookups++;
+        bool hit = e.valid && e.pc == pc && e.target == target;
+        if (hit) stats.btb_hits++;
+        return hit;
+    }
+    
+    void btb_update(uint32_t pc, uint32_t target) {
+        BtbEntry& e = btb[(pc >> 2) & (btb.size() - 1)];
+        e.valid = true;
+        e.pc = pc;
+        e.target = target;
+    }
+    
+    void record_site(uint32_t pc, bool taken, bool mispredicted) {
+        Site& site = sites[pc];
+        site.pc = pc;
+        site.executions++;
+        if (taken) site.taken++;
+        if (mispredicted) site.mispredicts++;
+    }
+};
+
+// ============================================================================
+// PIPELINE (IN-ORDER, 5 STAGES)
+// ============================================================================
+// Классический конвейер IF/ID/EX/MEM/WB поверх функционального execute():
+// инструкция уже выполнена, модель лишь решает, в каком такте она прошла бы
+// ID. Промахи I- и D-кэша замораживают весь конвейер, переходы решаются в EX
+class Pipeline {
+public:
+    static const uint32_t DEPTH = 5;
+    
+    // Такты сверх одного на инструкцию, по причинам
+    struct Statistics {
+        uint64_t fill = 0;          // заполнение конвейера
+        uint64_t fetch = 0;         // промахи I-кэша и обходы I-TLB
+        uint64_t load_use = 0;      // потребитель сразу за загрузкой
+        uint64_t raw = 0;           // прочие RAW: без forwarding или многотактный EX
+        uint64_t execute = 0;       // mul/div занимают EX несколько тактов
+        uint64_t memory = 0;        // промахи D-кэша и обходы D-TLB
+        uint64_t control = 0;       // сброс инструкций, выбранных после перехода
+    } stats;
+    
+    bool forwarding;
+    bool predicted;                 // штраф переходов считает BranchUnit
+    
+    Pipeline(bool forward, bool with_predictor) : forwarding(forward), predicted(with_predictor) {}
+    
+    // now - такт, в котором инструкция начала выборку (её такт ID, если
+    // выборка без промаха); возвращает такт ID следующей инструкции
+    uint64_t retire(uint64_t now, uint32_t instr, uint32_t pc, uint32_t next_pc, uint32_t ex_cycles,
+                    uint64_t fetch_stall, uint64_t memory_stall, uint32_t redirect_penalty) {
+        uint32_t opcode = instr & 0x7F;
+        uint32_t rd = (instr >> 7) & 0x1F;
+        uint32_t rs1 = (instr >> 15) & 0x1F;
+        uint32_t rs2 = (instr >> 20) & 0x1F;
+        bool uses_rs1 = opcode != 0x37 && opcode != 0x17 && opcode != 0x6F;
+        bool uses_rs2 = opcode == 0x33 || opcode == 0x23 || opcode == 0x63;
+        bool writes_rd = opcode != 0x23 && opcode != 0x63 && rd != 0;
+        
+        if (now == 0) {
+            stats.fill = DEPTH - 1;
+            now = DEPTH - 1;
+        }
+        now += fetch_stall;
+        stats.fetch += fetch_stall;
+        
+        // ID ждёт, пока операнды можно прочитать или переслать в EX
+        uint64_t need = now;
+        bool after_load = false;
+        if (uses_rs1 && rs1 != 0 && ready[rs1] > need) {
+            need = ready[rs1];
+            after_load = loaded[rs1];
+        }
+        if (uses_rs2 && rs2 != 0 && ready[rs2] > need) {
+            need = ready[rs2];
+            after_load = loaded[rs2];
+        }
+        if (need > now) {
+            if (forwarding && after_load) stats.load_use += need - now;
+            else stats.raw += need - now;
+            now = need;
+        }
+        
+        // ID в now, EX с now + 1, MEM после EX; без forwarding значение
+        // читается в ID того же такта, в котором пишется WB
+        if (writes_rd) {
+            bool load = opcode == 0x03;
+            uint64_t result = now + ex_cycles + (load ? 1 + memory_stall : 0);
+            ready[rd] = forwarding ? result : now + ex_cycles + 2 + memory_stall;
+            loaded[rd] = load;
+        }
+        
+        uint32_t control = 0;
+        if (predicted) control = redirect_penalty;
+        else if (opcode == 0x6F) control = 1;    // цель jal известна в ID
+        else if (opcode == 0x67) control = 2;
+        else if (opcode == 0x63 && next_pc != pc + 4) control = 2;      // predict not-taken
+        
+        stats.execute += ex_cycles ? ex_cycles - 1 : 0;  // латентность 0 допустима в --latency
+        stats.memory += memory_stall;
+        stats.control += control;
+        return now + ex_cycles + memory_stall + control;
+    }
+    
+private:
+    uint64_t ready[32] = {};        // такт ID, с которого регистр доступен потребителю
+    bool loaded[32] = {};           // последним регистр писала загрузка
+};
+
+// ============================================================================
+// RISC-V EMULATOR
+// ============================================================================
+class RiscVEmulator {
+public:
+    uint32_t regs[32];
+    uint32_t pc;
+    Memory memory;
+    MemoryPort port;                // write buffer и трафик между LLC и памятью
+    Cache* cache;                   // L1
+    std::vector<Cache*> hierarchy;  // L1, L2, ..., LLC
+    uint32_t initial_ra;
+    std::map<uint32_t, std::string> symbols;    // ELF: функции и объекты по адресу
+    bool use_lru;
+    LatencyConfig latency;
+    uint64_t instret = 0;           // выполненные инструкции
+    uint64_t cycles = 0;            // симулированные такты
+    uint64_t stop_after = 0;        // остановка через столько инструкций (0 - до конца)
+    bool keep_dirty = false;        // --save-checkpoint: после остановки кэши не сбрасываются
+    uint64_t reg_ready[32] = {};    // такт готовности регистра-приёмника загрузки (MSHR)
+    uint64_t load_ready = 0;        // такт готовности данных последней загрузки
+    
+    // --harts: у каждого hart свой L1 на общей шине, память общая. Harts
+    // чередуются по инструкции; активный живёт в regs/pc/cache, остальные - здесь
+    struct Hart {
+        uint32_t regs[32];
+        uint32_t pc = 0;
+        Cache* cache = nullptr;
+        uint64_t instret = 0;
+    };
+    std::vector<Hart> harts;        // пусто - один hart
+    std::vector<Cache*> bus;        // L1 всех harts
+    uint32_t active_hart = 0;
+    Mmu* mmu = nullptr;             // --sv32: pc и адреса данных - виртуальные
+    BranchUnit* branch_unit = nullptr;
+    Pipeline* pipeline = nullptr;   // --pipeline: cycles - такт ID следующей инструкции
+    
+    RiscVEmulator(bool lru, const SimConfig& config)
+        : port(&memory, config.write_buffer, config.latency.writeback),
+          use_lru(lru), latency(config.latency) {
+        memset(regs, 0, sizeof(regs));
+        pc = 0;
+        for (const CacheConfig& level : config.levels) {
+            Cache* c = new Cache(&port, level, config);
+            if (level.victim_entries > 0) c->attach_victim_cache(level.victim_entries, config.latency.victim);
+            if (!hierarchy.empty()) {
+                hierarchy.back()->next_level = c;
+                c->prev_level = hierarchy.back();
+            }
+            hierarchy.push_back(c);
+        }
+        cache = hierarchy.front();
+        cache->attach_prefetcher(config.prefetch);
+        if (config.sector_size != CACHE_LINE_SIZE) hierarchy.back()->enable_sectors(config.sector_size);
+        if (config.heat_interval > 0) cache->enable_heat_map(config.heat_interval);
+        if (config.sample_every > 0 || config.sample_random > 0) {
+            cache->enable_sampling(config.sample_every, config.sample_random, config.sample_seed);
+        }
+        if (config.pc_profile > 0) cache->pc_profile = new PcProfile();
+        if (config.mshr_entries > 0) cache->mshr = new MshrFile(config.mshr_entries);
+        if (config.reuse_distance) {
+            cache->instr_reuse = new ReuseDistance();
+            cache->data_reuse = new ReuseDistance();
+        }
+        if (config.harts > 1) attach_harts(config);
+        if (config.sv32) mmu = new Mmu(config);
+        if (!config.branch.predictors.empty()) {
+            branch_unit = new BranchUnit(config.branch, config.latency.mispredict);
+        }
+        if (config.pipeline) {
+            // Неблокирующие промахи - это уже не in-order конвейер с остановками
+            if (config.mshr_entries > 0) throw std::runtime_error("--pipeline is incompatible with --mshr");
+            pipeline = new Pipeline(config.forwarding, branch_unit != nullptr);
+        }
+    }
+    
+    ~RiscVEmulator() {
+        delete mmu;
+        delete branch_unit;
+        delete pipeline;
+        for (Cache* c : hierarchy) delete c;
+        for (size_t h = 1; h < bus.size(); h++) delete bus[h];
+    }
+    
+    void attach_harts(const SimConfig& config) {
+        if (config.levels.size() != 1 || config.levels[0].victim_entries > 0 ||
+            config.sector_size != CACHE_LINE_SIZE || config.mshr_entries > 0 ||
+            config.sample_every > 0 || config.sample_random > 0 || config.sv32 ||
+            !config.branch.predictors.empty() || config.pipeline) {
+            throw std::runtime_error("--harts needs a single cache level without victim cache, "
+                                     "sectors, MSHRs, sampling, MMU, branch prediction or pipeline");
+        }
+        // Эти отчёты строятся по одному L1, а у каждого hart он свой
+        if (config.classify_misses || config.prefetch.type != PrefetcherType::NONE || config.reuse_distance ||
+            config.pc_profile > 0 || config.heat_interval > 0) {
+            throw std::runtime_error("--harts cannot be combined with --3c, --prefetch, --reuse, --pc-profile "
+                                     "or --heatmap");
+        }
+        harts.resize(config.harts);
+        for (uint32_t h = 0; h < config.harts; h++) {
+            Cache* c = cache;
+            if (h > 0) {
+                c = new Cache(&port, config.levels[0], config);
+            }
+            harts[h].cache = c;
+            bus.push_back(c);
+        }
+        for (uint32_t h = 0; h < config.harts; h++) {
+            bus[h]->attach_coherence(&bus, h, config.coherence, config.latency.transfer);
+        }
+    }
+    
+    // Счётчики L1 за прогон: при --harts - сумма по приватным L1 всех harts
+    Cache::Statistics l1_stats() const {
+        Cache::Statistics sum = harts.empty() ? cache->stats : bus[0]->stats;
+        for (size_t h = 1; h < bus.size(); h++) {
+            const Cache::Statistics& st = bus[h]->stats;
+            sum.instr_access += st.instr_access;
+            sum.instr_hit += st.instr_hit;
+            sum.instr_miss += st.instr_miss;
+            sum.data_read_access += st.data_read_access;
+            sum.data_read_hit += st.data_read_hit;
+            sum.data_read_miss += st.data_read_miss;
+            sum.data_write_access += st.data_write_access;
+            sum.data_write_hit += st.data_write_hit;
+            sum.data_write_miss += st.data_write_miss;
+            sum.evictions += st.evictions;
+            sum.writebacks += st.writebacks;
+            sum.cycles += st.cycles;
+            sum.fill_bytes += st.fill_bytes;
+            sum.writeback_bytes += st.writeback_bytes;
+        }
+        return sum;
+    }
+    
+    void switch_hart(uint32_t next) {
+        Hart& current = harts[active_hart];
+        memcpy(current.regs, regs, sizeof(regs));
+        current.pc = pc;
+        memcpy(regs, harts[next].regs, sizeof(regs));
+        pc = harts[next].pc;
+        cache = harts[next].cache;
+        active_hart = next;
+    }
+    
+    // Round-robin: следующий hart, который ещё не вернулся (в начале прогона
+    // начиная с текущего); false - все вернулись
+    bool next_hart(bool first) {
+        uint32_t count = harts.size();
+        for (uint32_t step = 0; step < count; step++) {
+            uint32_t next = (active_hart + step + !first) % count;
+            uint32_t next_pc = next == active_hart ? pc : harts[next].pc;
+            if (next_pc != initial_ra) {
+                if (next != active_hart) switch_hart(next);
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    void check_alignment(uint32_t addr, uint32_t size) {
+        if (addr % size != 0) {
+            if (g_debug) {
+                std::cerr << "Warning: Unaligned access at 0x" << std::hex << addr 
+                          << " (size=" << std::dec << size << ")" << std::endl;
+            }
+        }
+    }
+    
+    int32_t sign_extend(uint32_t val, int bits) {
+        if (val & (1 << (bits - 1))) {
+            return val | (~((1 << bits) - 1));
+        }
+        return val;
+    }
+    
+    uint32_t fetch() {
+        if (g_debug) {
+            printf("[FETCH] PC=0x%08X\n", pc);
+        }
+        uint32_t paddr = pc;
+        if (mmu) {
+            paddr = mmu->translate(pc, true, false, cache, use_lru, pc);
+            cycles += mmu->last_latency;
+        }
+        uint32_t instr = cache->access(paddr, false, 0, 4, true, use_lru, pc);
+        // Попадание в L1 конвейеризовано, в такты идёт только задержка сверх него
+        cycles += cache->last_latency - cache->hit_latency;
+        // Промах выборки блокирующий, но линия может быть ещё в полёте после загрузки
+        if (cache->mshr) wait_until(cache->mshr->request(cache->get_block_addr(paddr), cycles, 0));
+        return instr;
+    }
+    
+    uint32_t data_access(uint32_t addr, bool is_write, uint32_t write_data, uint32_t size) {
+        if (mmu) {
+            addr = mmu->translate(addr, false, is_write, cache, use_lru, pc);
+            cycles += mmu->last_latency;
+        }
+        uint64_t misses = cache->stats.data_read_miss + cache->stats.data_write_miss;
+        uint32_t val = cache->access(addr, is_write, write_data, size, false, use_lru, pc);
+        uint32_t extra = cache->last_latency - cache->hit_latency;
+        if (!cache->mshr) {
+            cycles += extra;
+            return val;
+        }
+        
+        // Промах не останавливает процессор: данные нужны только читателю rd
+        bool miss = cache->stats.data_read_miss + cache->stats.data_write_miss != misses;
+        if (!miss) cycles += extra;
+        load_ready = cache->mshr->request(cache->get_block_addr(addr), cycles, miss ? extra : 0);
+        return val;
+    }
+    
+    void wait_until(uint64_t ready) {
+        if (ready <= cycles) return;
+        cache->mshr->stats.data_stall_cycles += ready - cycles;
+        cycles = ready;
+    }
+    
+    // Scoreboard: инструкция ждёт операнды и приёмник, которые ещё грузятся
+    void wait_operands(uint32_t instr) {
+        uint32_t opcode = instr & 0x7F;
+        bool uses_rs1 = opcode != 0x37 && opcode != 0x17 && opcode != 0x6F;
+        bool uses_rs2 = opcode == 0x33 || opcode == 0x23 || opcode == 0x63;
+        bool writes_rd = opcode != 0x23 && opcode != 0x63;
+        
+        uint64_t ready = 0;
+        if (uses_rs1) ready = std::max(ready, reg_ready[(instr >> 15) & 0x1F]);
+        if (uses_rs2) ready = std::max(ready, reg_ready[(instr >> 20) & 0x1F]);
+        if (writes_rd) ready = std::max(ready, reg_ready[(instr >> 7) & 0x1F]);
+        wait_until(ready);
+    }
+    
+    uint32_t exec_latency(uint32_t instr) {
+        uint32_t opcode = instr & 0x7F;
+        uint32_t funct3 = (instr >> 12) & 0x7;
+        uint32_t funct7 = (instr >> 25) & 0x7F;
+        
+        switch (opcode) {
+            case 0x33:
+                if (funct7 == 0x01) return funct3 >= 0x4 ? latency.div : latency.mul;
+                return latency.alu;
+            case 0x03: return latency.load;
+            case 0x23: return latency.store;
+            case 0x63: return latency.branch;
+            case 0x6F:
+            case 0x67: return latency.jump;
+            case 0x73: return latency.system;
+            default: return latency.alu;
+        }
+    }
+    
+    void execute(uint32_t instr) {
+        uint32_t opcode = instr & 0x7F;
+        uint32_t rd = (instr >> 7) & 0x1F;
+        uint32_t funct3 = (instr >> 12) & 0x7;
+        uint32_t rs1 = (instr >> 15) & 0x1F;
+        uint32_t rs2 = (instr >> 20) & 0x1F;
+        uint32_t funct7 = (instr >> 25) & 0x7F;
+        
+        regs[0] = 0;
+        
+        if (g_debug) {
+            printf("[EXEC] PC=0x%08X, instr=0x%08X, opcode=0x%02X\n", pc, instr, opcode);
+        }
+        
+        switch (opcode) {
+            case 0x33: { // R-type
+                if (funct7 == 0x00 && funct3 == 0x0) regs[rd] = regs[rs1] + regs[rs2];
+                else if (funct7 == 0x20 && funct3 == 0x0) regs[rd] = regs[rs1] - regs[rs2];
+                else if (funct7 == 0x00 && funct3 == 0x4) regs[rd] = regs[rs1] ^ regs[rs2];
+                else if (funct7 == 0x00 && funct3 == 0x6) regs[rd] = regs[rs1] | regs[rs2];
+                else if (funct7 == 0x00 && funct3 == 0x7) regs[rd] = regs[rs1] & regs[rs2];
+                else if (funct7 == 0x00 && funct3 == 0x1) regs[rd] = regs[rs1] << (regs[rs2] & 0x1F);
+                else if (funct7 == 0x00 && funct3 == 0x5) regs[rd] = regs[rs1] >> (regs[rs2] & 0x1F);
+                else if (funct7 == 0x20 && funct3 == 0x5) regs[rd] = ((int32_t)regs[rs1]) >> (regs[rs2] & 0x1F);
+                else if (funct7 == 0x00 && funct3 == 0x2) regs[rd] = ((int32_t)regs[rs1] < (int32_t)regs[rs2]) ? 1 : 0;
+                else if (funct7 == 0x00 && funct3 == 0x3) regs[rd] = (regs[rs1] < regs[rs2]) ? 1 : 0;
+                else if (funct7 == 0x01 && funct3 == 0x0) regs[rd] = regs[rs1] * regs[rs2];
+                else if (funct7 == 0x01 && funct3 == 0x1) {
+                    int64_t result = (int64_t)(int32_t)regs[rs1] * (int64_t)(int32_t)regs[rs2];
+                    regs[rd] = result >> 32;
+                }
+                else if (funct7 == 0x01 && funct3 == 0x2) {
+                    int64_t result = (int64_t)(int32_t)regs[rs1] * (uint64_t)regs[rs2];
+                    regs[rd] = result >> 32;
+                }
+                else if (funct7 == 0x01 && funct3 == 0x3) {
+                    uint64_t result = (uint64_t)regs[rs1] * (uint64_t)regs[rs2];
+                    regs[rd] = result >> 32;
+                }
+                else if (funct7 == 0x01 && funct3 == 0x4) {
+                    if (regs[rs2] == 0) regs[rd] = -1;
+                    else regs[rd] = (int32_t)regs[rs1] / (int32_t)regs[rs2];
+                }
+                else if (funct7 == 0x01 && funct3 == 0x5) {
+                    if (regs[rs2] == 0) regs[rd] = 0xFFFFFFFF;
+                    else regs[rd] = regs[rs1] / regs[rs2];
+                }
+                else if (funct7 == 0x01 && funct3 == 0x6) {
+                    if (regs[rs2] == 0) regs[rd] = regs[rs1];
+                    else regs[rd] = (int32_t)regs[rs1] % (int32_t)regs[rs2];
+                }
+                else if (funct7 == 0x01 && funct3 == 0x7) {
+                    if (regs[rs2] == 0) regs[rd] = regs[rs1];
+                    else regs[rd] = regs[rs1] % regs[rs2];
+                }
+                pc += 4;
+                break;
+            }
+            case 0x13: { // I-type
+                int32_t imm = sign_extend((instr >> 20) & 0xFFF, 12);
+                if (funct3 == 0x0) regs[rd] = regs[rs1] + imm;
+                else if (funct3 == 0x4) regs[rd] = regs[rs1] ^ imm;
+                else if (funct3 == 0x6) regs[rd] = regs[rs1] | imm;
+                else if (funct3 == 0x7) regs[rd] = regs[rs1] & imm;
+                else if (funct3 == 0x1) regs[rd] = regs[rs1] << (imm & 0x1F);
+                else if (funct3 == 0x5) {
+                    if ((instr >> 30) & 1) regs[rd] = ((int32_t)regs[rs1]) >> (imm & 0x1F);
+                    else regs[rd] = regs[rs1] >> (imm & 0x1F);
+                }
+                else if (funct3 == 0x2) regs[rd] = ((int32_t)regs[rs1] < imm) ? 1 : 0;
+                else if (funct3 == 0x3) regs[rd] = (regs[rs1] < (uint32_t)imm) ? 1 : 0;
+                pc += 4;
+                break;
+            }
+            case 0x03: { // Load
+                int32_t imm = sign_extend((instr >> 20) & 0xFFF, 12);
+                uint32_t addr = regs[rs1] + imm;
+                if (funct3 == 0x0) {
+                    uint8_t val = data_access(addr, false, 0, 1);
+                    regs[rd] = sign_extend(val, 8);
+                } else if (funct3 == 0x1) {
+                    check_alignment(addr, 2);
+                    uint16_t val = data_access(addr, false, 0, 2);
+                    regs[rd] = sign_extend(val, 16);
+                } else if (funct3 == 0x2) {
+                    check_alignment(addr, 4);
+                    regs[rd] = data_access(addr, false, 0, 4);
+                } else if (funct3 == 0x4) {
+                    regs[rd] = data_access(addr, false, 0, 1);
+                } else if (funct3 == 0x5) {
+                    check_alignment(addr, 2);
+                    regs[rd] = data_access(addr, false, 0, 2);
+                }
+                pc += 4;
+                break;
+            }
+            case 0x23: { // Store
+                int32_t imm = sign_extend(((instr >> 25) << 5) | rd, 12);
+                uint32_t addr = regs[rs1] + imm;
+                if (funct3 == 0x0) {
+                    data_access(addr, true, regs[rs2] & 0xFF, 1);
+                } else if (funct3 == 0x1) {
+                    check_alignment(addr, 2);
+                    data_access(addr, true, regs[rs2] & 0xFFFF, 2);
+                } else if (funct3 == 0x2) {
+                    check_alignment(addr, 4);
+                    data_access(addr, true, regs[rs2], 4);
+                }
+                pc += 4;
+                break;
+            }
+            case 0x63: { // Branch
+                int32_t imm = sign_extend(
+                    ((instr >> 31) << 12) | (((instr >> 7) & 1) << 11) |
+                    (((instr >> 25) & 0x3F) << 5) | (((instr >> 8) & 0xF) << 1), 13);
+                bool taken = false;
+                if (funct3 == 0x0) taken = (regs[rs1] == regs[rs2]);
+                else if (funct3 == 0x1) taken = (regs[rs1] != regs[rs2]);
+                else if (funct3 == 0x4) taken = ((int32_t)regs[rs1] < (int32_t)regs[rs2]);
+                else if (funct3 == 0x5) taken = ((int32_t)regs[rs1] >= (int32_t)regs[rs2]);
+                else if (funct3 == 0x6) taken = (regs[rs1] < regs[rs2]);
+                else if (funct3 == 0x7) taken = (regs[rs1] >= regs[rs2]);
+                
+                if (taken) pc += imm;
+                else pc += 4;
+                break;
+            }
+            case 0x6F: { // JAL
+                int32_t imm = sign_extend(
+                    ((instr >> 31) << 20) | (((instr >> 12) & 0xFF) << 12) |
+                    (((instr >> 20) & 1) << 11) | (((instr >> 21) & 0x3FF) << 1), 21);
+                regs[rd] = pc + 4;
+                pc += imm;
+                break;
+            }
+            case 0x67: { // JALR
+                int32_t imm = sign_extend((instr >> 20) & 0xFFF, 12);
+                uint32_t target = (regs[rs1] + imm) & ~1;
+                regs[rd] = pc + 4;
+                pc = target;
+                break;
+            }
+            case 0x37: { // LUI
+                int32_t imm = instr & 0xFFFFF000;
+                regs[rd] = imm;
+                pc += 4;
+                break;
+            }
+            case 0x17: { // AUIPC
+                int32_t imm = instr & 0xFFFFF000;
+                regs[rd] = pc + imm;
+                pc += 4;
+                break;
+            }
+            case 0x73: { // ECALL/EBREAK
+                // csrr rd, mhartid: номер hart для разделения работы
+                if (funct3 == 0x2 && (instr >> 20) == 0xF14 && rs1 == 0) {
+                    regs[rd] = active_hart;
+                    pc += 4;
+                    break;
+                }
+                if (g_debug) printf("[EXEC] ECALL/EBREAK - terminating\n");
+                return;
+            }
+            default:
+                if (g_debug) printf("[EXEC] Unknown opcode: 0x%02X\n", opcode);
+                pc += 4;
+                break;
+        }
+        
+        regs[0] = 0;
+    }
+    
+    void run() {
+        const uint64_t MAX_INSTRUCTIONS = 1000000;
+        uint64_t start = instret;
+        
+        // Все harts стартуют из загруженного состояния
+        if (!harts.empty() && instret == 0) {
+            for (Hart& h : harts) {
+                memcpy(h.regs, regs, sizeof(regs));
+                h.pc = pc;
+            }
+        }
+        
+        while (instret < MAX_INSTRUCTIONS && (stop_after == 0 || instret - start < stop_after)) {
+            if (harts.empty() ? pc == initial_ra : !next_hart(instret == start)) break;
+            if (!harts.empty()) harts[active_hart].instret++;
+            
+            uint64_t issued = cycles;
+            uint32_t instr = fetch();
+            uint64_t fetched = cycles;
+            uint32_t instr_pc = pc;
+            if (cache->mshr) wait_operands(instr);
+            execute(instr);
+            uint32_t redirect = branch_unit ? branch_unit->resolve(instr, instr_pc, pc) : 0;
+            if (pipeline) {
+                // fetch() и data_access() добавили в cycles задержки сверх попадания
+                cycles = pipeline->retire(issued, instr, instr_pc, pc, exec_latency(instr),
+                                          fetched - issued, cycles - fetched, redirect);
+            } else {
+                if (cache->mshr && (instr & 0x7F) == 0x03 && ((instr >> 7) & 0x1F) != 0) {
+                    reg_ready[(instr >> 7) & 0x1F] = load_ready;
+                }
+                cycles += redirect + exec_latency(instr);
+            }
+            instret++;
+        }
+        
+        // Состояние MSHR не сохраняется в checkpoint: линии в полёте дожидаемся
+        if (cache->mshr) {
+            cycles = cache->mshr->drain(cycles);
+            memset(reg_ready, 0, sizeof(reg_ready));
+        }
+        
+        // Остановка под checkpoint: грязные линии и write buffer остаются как есть,
+        // их запишет в память (и учтёт в трафике) продолженный прогон
+        bool stopped = keep_dirty && stop_after != 0 && instret - start >= stop_after;
+        
+        // Flush идёт от hart 0; грязные линии остальных L1 - в память
+        if (!harts.empty()) {
+            switch_hart(0);
+            if (!stopped) {
+                for (size_t h = 1; h < bus.size(); h++) bus[h]->flush();
+            }
+        }
+        
+        if (instret >= MAX_INSTRUCTIONS) {
+            std::cerr << "Warning: Reached max instruction limit (" << MAX_INSTRUCTIONS << ")" << std::endl;
+            std::cerr << "PC = 0x" << std::hex << pc << ", initial_ra = 0x" << initial_ra << std::dec << std::endl;
+        }
+        
+        if (g_debug) {
+            printf("\n[RUN] Executed %lu instructions\n", instret);
+        }
+        
+        cache->finish_heat_map();
+        if (!stopped) cache->flush();
+    }
+    
+    // Trace-driven режим: внешняя трасса сразу в L1, программы нет. instret -
+    // выборки инструкций; такты не считаются, опкодов в трассе нет
+    void replay_trace(const MappedFile& file) {
+        for_each_trace_record(file, [&](const TraceRecord& r) {
+            cache->access(r.addr, r.type == AccessType::WRITE, 0, r.size, r.type == AccessType::INSTR, use_lru, r.pc);
+            instret += r.type == AccessType::INSTR;
+        });
+        cache->finish_heat_map();
+        cache->flush();
+    }
+    
+    // Слово инструкции по pc для отчётов: под --sv32 pc виртуальный
+    uint32_t instruction_at(uint32_t addr) {
+        if (mmu && !mmu->peek(addr, memory, addr)) return 0;
+        return addr <= MEMORY_SIZE - 4 ? memory.read32(addr) : 0;
+    }
+    
+    // "<main+0x14>" для адреса внутри известного символа, иначе пусто
+    std::string symbolize(uint32_t addr) const {
+        auto it = symbols.upper_bound(addr);
+        if (it == symbols.begin()) return "";
+        --it;
+        char offset[16];
+        snprintf(offset, sizeof(offset), "+0x%X", addr - it->first);
+        return "<" + it->second + (addr == it->first ? "" : offset) + ">";
+    }
+};
+
+// ============================================================================
+// FILE I/O
+// ============================================================================
+// ELF32 little-endian RISC-V: только статически слинкованные ET_EXEC
+struct Elf32Header {
+    uint8_t ident[16];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint32_t entry;
+    uint32_t phoff;
+    uint32_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+};
+
+struct Elf32ProgramHeader {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t vaddr;
+    uint32_t paddr;
+    uint32_t filesz;
+    uint32_t memsz;
+    uint32_t flags;
+    uint32_t align;
+};
+
+struct Elf32SectionHeader {
+    uint32_t name;
+    uint32_t type;
+    uint32_t flags;
+    uint32_t addr;
+    uint32_t offset;
+    uint32_t size;
+    uint32_t link;
+    uint32_t info;
+    uint32_t addralign;
+    uint32_t entsize;
+};
+
+struct Elf32Symbol {
+    uint32_t name;
+    uint32_t value;
+    uint32_t size;
+    uint8_t info;
+    uint8_t other;
+    uint16_t shndx;
+};
+
+const uint16_t ELF_MACHINE_RISCV = 243;
+const uint32_t ELF_STACK_TOP = MEMORY_SIZE - 16;            // sp, выровнен на 16
+const uint32_t ELF_RETURN_SENTINEL = MEMORY_SIZE - 4;       // ra: возврат из entry - конец
+
+bool is_elf_file(const std::vector<uint8_t>& image) {
+    return image.size() >= 4 && memcmp(image.data(), "\x7F" "ELF", 4) == 0;
+}
+
+// Структура по смещению с проверкой границ образа
+template <typename T>
+T read_at(const std::vector<uint8_t>& image, uint64_t offset) {
+    if (offset + sizeof(T) > image.size()) throw std::runtime_error("Truncated input image");
+    T value;
+    memcpy(&value, image.data() + offset, sizeof(T));
+    return value;
+}
+
+void load_elf(const std::vector<uint8_t>& image, RiscVEmulator& emu) {
+    Elf32Header header = read_at<Elf32Header>(image, 0);
+    if (header.ident[4] != 1 || header.ident[5] != 1) {
+        throw std::runtime_error("Only little-endian ELF32 files are supported");
+    }
+    if (header.machine != ELF_MACHINE_RISCV) {
+        throw std::runtime_error("Not a RISC-V ELF file (machine " + std::to_string(header.machine) + ")");
+    }
+    if (header.type != 2) throw std::runtime_error("Only ELF executables (ET_EXEC) are supported");
+    
+    // PT_LOAD - копия файлового образа по физическому адресу, хвост .bss обнуляется
+    for (uint32_t i = 0; i < header.phnum; i++) {
+        Elf32ProgramHeader ph = read_at<Elf32ProgramHeader>(image, header.phoff + (uint64_t)i * header.phentsize);
+        if (ph.type == 2 || ph.type == 3) {
+            throw std::runtime_error("Dynamically linked ELF files are not supported");
+        }
+        if (ph.type != 1 || ph.memsz == 0) continue;
+        if (ph.filesz > ph.memsz || (uint64_t)ph.offset + ph.filesz > image.size()) {
+            throw std::runtime_error("Malformed ELF segment");
+        }
+        if ((uint64_t)ph.paddr + ph.memsz > MEMORY_SIZE) {
+            throw std::runtime_error("ELF segment does not fit into memory: " + std::to_string(ph.paddr) +
+                                     " + " + std::to_string(ph.memsz));
+        }
+        if (ph.filesz > 0) emu.memory.write_block(ph.paddr, image.data() + ph.offset, ph.filesz);
+        std::fill(emu.memory.data.begin() + ph.paddr + ph.filesz,
+                  emu.memory.data.begin() + ph.paddr + ph.memsz, 0);
+    }
+    
+    // Символы функций и объектов из .symtab (у stripped-файла её нет).
+    // __global_pointer$ линкер выдаёт как NOTYPE/SHN_ABS, он ищется до фильтра
+    uint32_t global_pointer = 0;
+    for (uint32_t i = 0; i < header.shnum; i++) {
+        Elf32SectionHeader sh = read_at<Elf32SectionHeader>(image, header.shoff + (uint64_t)i * header.shentsize);
+        if (sh.type != 2 || sh.link >= header.shnum) continue;
+        Elf32SectionHeader strtab = read_at<Elf32SectionHeader>(image, header.shoff + (uint64_t)sh.link * header.shentsize);
+        if ((uint64_t)strtab.offset + strtab.size > image.size()) {
+            throw std::runtime_error("Malformed ELF string table");
+        }
+        for (uint32_t offset = 0; offset + sizeof(Elf32Symbol) <= sh.size; offset += sizeof(Elf32Symbol)) {
+            Elf32Symbol sym = read_at<Elf32Symbol>(image, (uint64_t)sh.offset + offset);
+            uint8_t kind = sym.info & 0xF;
+            if (sym.shndx == 0 || sym.name >= strtab.size) continue;
+            const char* name = (const char*)image.data() + strtab.offset + sym.name;
+            std::string symbol(name, strnlen(name, strtab.size - sym.name));
+            if (symbol == "__global_pointer$") global_pointer = sym.value;
+            if (kind == 1 || kind == 2) emu.symbols.emplace(sym.value, symbol);
+        }
+    }
+    
+    memset(emu.regs, 0, sizeof(emu.regs));
+    emu.pc = header.entry;
+    emu.regs[1] = ELF_RETURN_SENTINEL;
+    emu.regs[2] = ELF_STACK_TOP;
+    emu.regs[3] = global_pointer;
+    emu.initial_ra = ELF_RETURN_SENTINEL;
+    
+    if (g_debug) {
+        printf("[FILE] Loaded ELF: entry=0x%08X, %zu symbols\n", emu.pc, emu.symbols.size());
+    }
+}
+
+bool read_file(const char* filename, std::vector<uint8_t>& image) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) return false;
+    image.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// Образ в памяти: ELF32 или собственный формат (PC, x1..x31, фрагменты addr/size/bytes)
+void load_image(const std::vector<uint8_t>& image, RiscVEmulator& emu) {
+    if (is_elf_file(image)) {
+        load_elf(image, emu);
+        return;
+    }
+    
+    emu.pc = read_at<uint32_t>(image, 0);
+    for (int i = 1; i < 32; i++) {
+        emu.regs[i] = read_at<uint32_t>(image, i * 4);
+    }
+    emu.initial_ra = emu.regs[1];
+    
+    for (uint64_t offset = 128; offset < image.size();) {
+        uint32_t addr = read_at<uint32_t>(image, offset);
+        uint32_t size = read_at<uint32_t>(image, offset + 4);
+        offset += 8;
+        if (offset + size > image.size()) throw std::runtime_error("Truncated input image");
+        if (size > 0) emu.memory.write_block(addr, image.data() + offset, size);
+        offset += size;
+    }
+    
+    if (g_debug) {
+        printf("[FILE] Loaded: PC=0x%08X, RA=0x%08X\n", emu.pc, emu.initial_ra);
+    }
+}
+
+bool read_input_file(const char* filename, RiscVEmulator& emu) {
+    std::vector<uint8_t> image;
+    if (!read_file(filename, image)) return false;
+    load_image(image, emu);
+    return true;
+}
+
+bool write_output_file(const char* filename, RiscVEmulator& emu, 
+                       uint32_t start_addr, uint32_t size) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) return false;
+    
+    file.write((char*)&emu.pc, 4);
+    for (int i = 1; i < 32; i++) {
+        file.write((char*)&emu.regs[i], 4);
+    }
+    
+    file.write((char*)&start_addr, 4);
+    file.write((char*)&size, 4);
+    for (uint32_t i = 0; i < size; i++) {
+        uint8_t byte = emu.memory.read8(start_addr + i);
+        file.write((char*)&byte, 1);
+    }
+    
+    return true;
+}
+
+// Тепловая карта наборов L1: строки - наборы, столбцы - интервалы.
+// *.pgm - ASCII PGM (P2, яркость = промахи), иначе CSV
+bool write_heat_map(const std::string& filename, Cache* c) {
+    std::ofstream file(filename);
+    if (!file) return false;
+    
+    uint32_t intervals = c->heat_intervals();
+    bool pgm = filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".pgm") == 0;
+    
+    if (pgm) {
+        uint32_t max_value = 1;
+        for (uint32_t v : c->heat_map) max_value = std::max(max_value, v);
+        file << "P2\n" << intervals << " " << c->set_count << "\n" << max_value << "\n";
+    } else {
+        file << "set";
+        for (uint32_t i = 0; i < intervals; i++) file << "," << (uint64_t)i * c->heat_interval;
+        file << "\n";
+    }
+    
+    for (uint32_t s = 0; s < c->set_count; s++) {
+        if (!pgm) file << s;
+        for (uint32_t i = 0; i < intervals; i++) {
+            if (pgm && i > 0) file << " ";
+            if (!pgm) file << ",";
+            file << c->heat_map[(size_t)i * c->set_count + s];
+        }
+        file << "\n";
+    }
+    return true;
+}
+
+// heat.csv -> heat_lru.csv
+std::string with_suffix(const std::string& filename, const char* suffix) {
+    size_t dot = filename.find_last_of('.');
+    size_t slash = filename.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return filename + suffix;
+    return filename.substr(0, dot) + suffix + filename.substr(dot);
+}
+
+// Checkpoint эмулятора: регистры и память вместе с состоянием всех уровней
+bool save_checkpoint(const std::string& filename, RiscVEmulator& emu) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) return false;
+    
+    write_pod(file, CHECKPOINT_MAGIC);
+    write_pod(file, CHECKPOINT_VERSION);
+    write_pod<uint8_t>(file, emu.use_lru);
+    write_pod(file, MEMORY_SIZE);
+    write_pod(file, CACHE_LINE_SIZE);
+    write_pod<uint32_t>(file, emu.hierarchy.size());
+    
+    write_pod(file, emu.pc);
+    file.write((const char*)emu.regs, sizeof(emu.regs));
+    write_pod(file, emu.initial_ra);
+    write_pod(file, emu.instret);
+    write_pod(file, emu.cycles);
+    write_vector(file, emu.memory.data);
+    
+    for (Cache* c : emu.hierarchy) c->save_state(file);
+    
+    // Write buffer: незаписанные блоки и счётчики трафика
+    write_pod(file, emu.port.capacity);
+    write_pod<uint32_t>(file, emu.port.buffer.size());
+    for (const MemoryPort::Entry& e : emu.port.buffer) write_pod(file, e);
+    write_pod(file, emu.port.stats);
+    
+    write_pod<uint8_t>(file, emu.mmu != nullptr);
+    if (emu.mmu) emu.mmu->save_state(file);
+    return (bool)file;
+}
+
+bool load_checkpoint(const std::string& filename, RiscVEmulator& emu) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) return false;
+    
+    if (read_pod<uint32_t>(file) != CHECKPOINT_MAGIC) {
+        throw std::runtime_error("Not a checkpoint file: " + filename);
+    }
+    uint32_t version = read_pod<uint32_t>(file);
+    if (version != CHECKPOINT_VERSION) {
+        throw std::runtime_error("Unsupported checkpoint version " + std::to_string(version));
+    }
+    if ((bool)read_pod<uint8_t>(file) != emu.use_lru) {
+        throw std::runtime_error("Checkpoint replacement policy mismatch: " + filename);
+    }
+    if (read_pod<uint32_t>(file) != MEMORY_SIZE || read_pod<uint32_t>(file) != CACHE_LINE_SIZE ||
+        read_pod<uint32_t>(file) != emu.hierarchy.size()) {
+        throw std::runtime_error("Checkpoint geometry mismatch: " + filename);
+    }
+    
+    emu.pc = read_pod<uint32_t>(file);
+    if (!file.read((char*)emu.regs, sizeof(emu.regs))) throw std::runtime_error("Truncated checkpoint");
+    emu.initial_ra = read_pod<uint32_t>(file);
+    emu.instret = read_pod<uint64_t>(file);
+    emu.cycles = read_pod<uint64_t>(file);
+    read_vector(file, emu.memory.data, "memory size");
+    
+    for (Cache* c : emu.hierarchy) c->load_state(file);
+    
+    if (read_pod<uint32_t>(file) != emu.port.capacity) {
+        throw std::runtime_error("Checkpoint mismatch: write buffer size");
+    }
+    uint32_t pending = read_pod<uint32_t>(file);
+    if (pending > emu.port.capacity) throw std::runtime_error("Checkpoint mismatch: write buffer entries");
+    emu.port.buffer.clear();
+    for (uint32_t i = 0; i < pending; i++) emu.port.buffer.push_back(read_pod<MemoryPort::Entry>(file));
+    emu.port.stats = read_pod<MemoryPort::Statistics>(file);
+    
+    if ((bool)read_pod<uint8_t>(file) != (emu.mmu != nullptr)) {
+        throw std::runtime_error("Checkpoint MMU mismatch: " + filename);
+    }
+    if (emu.mmu) emu.mmu->load_state(file);
+    
+    if (g_debug) {
+        printf("[FILE] Checkpoint loaded: PC=0x%08X, instret=%lu\n", emu.pc, (unsigned long)emu.instret);
+    }
+    return true;
+}
+
+// ============================================================================
+// DISASSEMBLER
+// ============================================================================
+const char* const REG_NAMES[32] = {
+    "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+    "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+    "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+    "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"
+};
+
+// RV32IM в синтаксисе objdump (адреса переходов - абсолютные)
+std::string disassemble(uint32_t instr, uint32_t pc) {
+    uint32_t opcode = instr & 0x7F;
+    const char* rd = REG_NAMES[(instr >> 7) & 0x1F];
+    const char* rs1 = REG_NAMES[(instr >> 15) & 0x1F];
+    const char* rs2 = REG_NAMES[(instr >> 20) & 0x1F];
+    uint32_t funct3 = (instr >> 12) & 0x7;
+    uint32_t funct7 = (instr >> 25) & 0x7F;
+    int32_t imm_i = (int32_t)instr >> 20;
+    int32_t imm_s = ((int32_t)instr >> 25 << 5) | ((instr >> 7) & 0x1F);
+    char buf[64];
+    
+    switch (opcode) {
+        case 0x33: {
+            static const char* const base[8] = {"add", "sll", "slt", "sltu", "xor", "srl", "or", "and"};
+            static const char* const muldiv[8] = {"mul", "mulh", "mulhsu", "mulhu", "div", "divu", "rem", "remu"};
+            const char* name = funct7 == 0x01 ? muldiv[funct3] : base[funct3];
+            if (funct7 == 0x20 && funct3 == 0x0) name = "sub";
+            if (funct7 == 0x20 && funct3 == 0x5) name = "sra";
+            snprintf(buf, sizeof(buf), "%s %s,%s,%s", name, rd, rs1, rs2);
+            break;
+        }
+        case 0x13: {
+            static const char* const names[8] = {"addi", "slli", "slti", "sltiu", "xori", "srli", "ori", "andi"};
+            const char* name = names[funct3];
+            int32_t imm = imm_i;
+            if (funct3 == 0x1 || funct3 == 0x5) {
+                imm &= 0x1F;
+                if (funct3 == 0x5 && (instr >> 30) & 1) name = "srai";
+            }
+            snprintf(buf, sizeof(buf), "%s %s,%s,%d", name, rd, rs1, imm);
+            break;
+        }
+        case 0x03: {
+            static const char* const names[8] = {"lb", "lh", "lw", "?", "lbu", "lhu", "?", "?"};
+            snprintf(buf, sizeof(buf), "%s %s,%d(%s)", names[funct3], rd, imm_i, rs1);
+            break;
+        }
+        case 0x23: {
+            static const char* const names[8] = {"sb", "sh", "sw", "?", "?", "?", "?", "?"};
+            snprintf(buf, sizeof(buf), "%s %s,%d(%s)", names[funct3], rs2, imm_s, rs1);
+            break;
+        }
+        case 0x63: {
+            static const char* const names[8] = {"beq", "bne", "?", "?", "blt", "bge", "bltu", "bgeu"};
+            int32_t imm = ((int32_t)instr >> 31 << 12) | (((instr >> 7) & 1) << 11) |
+                          (((instr >> 25) & 0x3F) << 5) | (((instr >> 8) & 0xF) << 1);
+            snprintf(buf, sizeof(buf), "%s %s,%s,0x%x", names[funct3], rs1, rs2, pc + imm);
+            break;
+        }
+        case 0x6F: {
+            int32_t imm = ((int32_t)instr >> 31 << 20) | (((instr >> 12) & 0xFF) << 12) |
+                          (((instr >> 20) & 1) << 11) | (((instr >> 21) & 0x3FF) << 1);
+            snprintf(buf, sizeof(buf), "jal %s,0x%x", rd, pc + imm);
+            break;
+        }
+        case 0x67:
+            snprintf(buf, sizeof(buf), "jalr %s,%d(%s)", rd, imm_i, rs1);
+            break;
+        case 0x37:
+            snprintf(buf, sizeof(buf), "lui %s,0x%x", rd, instr >> 12);
+            break;
+        case 0x17:
+            snprintf(buf, sizeof(buf), "auipc %s,0x%x", rd, instr >> 12);
+            break;
+        case 0x73:
+            if (((instr >> 12) & 0x7) == 0x2 && (instr >> 20) == 0xF14) {
+                snprintf(buf, sizeof(buf), "csrr %s,mhartid", rd);
+                break;
+            }
+            snprintf(buf, sizeof(buf), "%s", instr == 0x00100073 ? "ebreak" : "ecall");
+            break;
+        default:
+            snprintf(buf, sizeof(buf), ".word 0x%08x", instr);
+            break;
+    }
+    return buf;
+}
+
+// ============================================================================
+// REPORTING
+// ============================================================================
+void print_hierarchy_stats(const char* replacement, RiscVEmulator& emu) {
+    for (Cache* c : emu.hierarchy) {
+        uint64_t access = c->stats.instr_access + c->stats.data_read_access + c->stats.data_write_access;
+        uint64_t hits = c->stats.instr_hit + c->stats.data_read_hit + c->stats.data_write_hit;
+        const char* inclusion = c->prev_level ? inclusion_name(c->inclusion) : "-";
+        
+        if (access == 0) {
+            printf("| %s | %s | %s | %4ux%-2u | %12d | %12d | nan%% | %12lu | %12lu |\n",
+                   replacement, c->name.c_str(), inclusion, c->set_count, c->ways, 0, 0,
+                   (unsigned long)c->stats.writebacks,
+                   (unsigned long)c->stats.back_invalidations);
+        } else {
+            printf("| %s | %s | %s | %4ux%-2u | %12lu | %12lu | %3.4f%% | %12lu | %12lu |\n",
+                   replacement, c->name.c_str(), inclusion, c->set_count, c->ways,
+                   (unsigned long)access, (unsigned long)hits,
+                   (double)hits / access * 100.0,
+                   (unsigned long)c->stats.writebacks,
+                   (unsigned long)c->stats.back_invalidations);
+        }
+    }
+}
+
+void print_timing_stats(const char* replacement, RiscVEmulator& emu) {
+    printf("| %s | %12lu | %12lu | %3.4f |", replacement,
+           (unsigned long)emu.instret, (unsigned long)emu.cycles,
+           emu.instret ? (double)emu.cycles / emu.instret : 0.0);
+    
+    for (Cache* c : emu.hierarchy) {
+        const Cache::Statistics st = c == emu.cache ? emu.l1_stats() : c->stats;
+        uint64_t access = st.instr_access + st.data_read_access + st.data_write_access;
+        if (access == 0) printf(" nan |");
+        else printf(" %3.4f |", (double)st.cycles / access);
+    }
+    printf("\n");
+}
+
+double ratio_percent(uint64_t num, uint64_t den) {
+    return den ? (double)num / den * 100.0 : 0.0;
+}
+
+void print_prefetch_stats(const char* replacement, RiscVEmulator& emu) {
+    Cache* c = emu.cache;
+    const Cache::PrefetchStatistics& pf = c->pf_stats;
+    uint64_t demand_miss = c->stats.instr_miss + c->stats.data_read_miss + c->stats.data_write_miss;
+    
+    printf("| %s | %s | %12lu | %12lu | %12lu | %12lu | %12lu | %12lu | %3.4f%% | %3.4f%% | %3.4f%% |\n",
+           replacement, c->prefetcher->name(),
+           (unsigned long)pf.issued, (unsigned long)pf.filled, (unsigned long)pf.useful,
+           (unsigned long)pf.late, (unsigned long)pf.useless, (unsigned long)pf.pollution,
+           ratio_percent(pf.useful + pf.late, pf.issued),
+           ratio_percent(pf.useful, pf.useful + demand_miss),
+           ratio_percent(pf.useful, pf.useful + pf.late));
+}
+
+void print_victim_stats(const char* replacement, RiscVEmulator& emu) {
+    Cache* c = emu.cache;
+    printf("| %s | %12lu | %12lu | %12lu | %3.4f%% | %12lu | %12lu |\n",
+           replacement, (unsigned long)c->victim_entries.size(),
+           (unsigned long)c->vc_stats.probes, (unsigned long)c->vc_stats.hits,
+           ratio_percent(c->vc_stats.hits, c->vc_stats.probes),
+           (unsigned long)c->vc_stats.inserts, (unsigned long)c->vc_stats.writebacks);
+}
+
+void print_traffic_stats(const char* replacement, RiscVEmulator& emu) {
+    const MemoryPort::Statistics& mem = emu.port.stats;
+    printf("| %s | %s | %12u | %12lu | %12lu | %12lu | %12lu | %12lu | %12lu |\n",
+           replacement, write_policy_name(emu.cache->write_policy, emu.cache->write_miss),
+           emu.port.capacity,
+           (unsigned long)mem.read_bytes, (unsigned long)mem.write_bytes,
+           (unsigned long)mem.write_requests, (unsigned long)mem.coalesced,
+           (unsigned long)mem.memory_writes, (unsigned long)mem.stalls);
+}
+
+void print_miss_classes(const char* replacement, RiscVEmulator& emu) {
+    for (Cache* c : emu.hierarchy) {
+        uint64_t misses = c->stats.compulsory_misses + c->stats.capacity_misses + c->stats.conflict_misses;
+        printf("| %s | %s | %12lu | %12lu | %12lu | %12lu | %3.4f%% |\n",
+               replacement, c->name.c_str(), (unsigned long)misses,
+               (unsigned long)c->stats.compulsory_misses,
+               (unsigned long)c->stats.capacity_misses,
+               (unsigned long)c->stats.conflict_misses,
+               ratio_percent(c->stats.conflict_misses, misses));
+    }
+}
+
+// В trace-driven прогоне программы в памяти нет: дизассемблировать нечего
+void print_pc_profile(const char* replacement, RiscVEmulator& emu, uint32_t count) {
+    for (const PcProfile::Entry& e : emu.cache->pc_profile->top(count)) {
+        std::string text = emu.cache->trace_driven ? "-" : disassemble(emu.instruction_at(e.pc), e.pc);
+        if (!emu.symbols.empty()) text += " " + emu.symbolize(e.pc);
+        printf("| %s | 0x%08X | %-24s | %12u | %12u | %12u | %3.4f%% | %12u |\n",
+               replacement, e.pc, text.c_str(), e.accesses, e.hits, e.misses,
+               ratio_percent(e.misses, e.accesses), e.writebacks);
+    }
+}
+
+void print_set_stats(const char* replacement, RiscVEmulator& emu) {
+    Cache* c = emu.cache;
+    for (uint32_t s = 0; s < c->set_count; s++) {
+        const Cache::SetStatistics& st = c->set_stats[s];
+        printf("| %s | %4u | %12u | %12u | %3.4f%% | %12u |\n",
+               replacement, s, st.accesses, st.misses,
+               ratio_percent(st.misses, st.accesses), st.evictions);
+    }
+}
+
+void print_occupancy(const char* replacement, RiscVEmulator& emu) {
+    printf("| %s |", replacement);
+    for (uint64_t sets : emu.cache->occupancy_hist) printf(" %12lu |", (unsigned long)sets);
+    printf("\n");
+}
+
+// Гистограмма не зависит от политики замещения. cumulative - доля обращений
+// с расстоянием меньше верхней границы корзины, т.е. hit rate полностью
+// ассоциативного LRU-кэша из стольких линий
+void print_reuse_histogram(RiscVEmulator& emu) {
+    const ReuseDistance& instr = *emu.cache->instr_reuse;
+    const ReuseDistance& data = *emu.cache->data_reuse;
+    size_t buckets = std::max(instr.histogram.size(), data.histogram.size());
+    uint64_t instr_total = instr.total(), data_total = data.total();
+    uint64_t instr_cum = 0, data_cum = 0;
+    
+    for (size_t b = 1; b < buckets; b++) {
+        uint64_t i_count = b < instr.histogram.size() ? instr.histogram[b] : 0;
+        uint64_t d_count = b < data.histogram.size() ? data.histogram[b] : 0;
+        instr_cum += i_count;
+        data_cum += d_count;
+        uint32_t lo = b == 1 ? 0 : 1u << (b - 2);
+        uint32_t hi = b == 1 ? 1 : 1u << (b - 1);
+        printf("| [%u, %u) | %12lu | %12lu | %3.4f%% | %3.4f%% |\n", lo, hi,
+               (unsigned long)i_count, (unsigned long)d_count,
+               ratio_percent(instr_cum, instr_total), ratio_percent(data_cum, data_total));
+    }
+    printf("| cold | %12lu | %12lu | - | - |\n",
+           (unsigned long)(instr.histogram.empty() ? 0 : instr.histogram[0]),
+           (unsigned long)(data.histogram.empty() ? 0 : data.histogram[0]));
+}
+
+// Оценка hit rate по выборке наборов (ratio estimator, наборы - кластеры):
+// half_width - полуширина 95% доверительного интервала
+struct SampledRate {
+    bool valid = false;             // в выбранных наборах были обращения
+    double rate = 0.0;
+    double half_width = 0.0;
+};
+
+SampledRate estimate_sampled_rate(Cache* c, bool instr, bool data) {
+    std::vector<double> hits, accesses;
+    double sum_hits = 0, sum_accesses = 0;
+    for (uint32_t s = 0; s < c->set_count; s++) {
+        if (!c->is_sampled(s)) continue;
+        const Cache::SetStatistics& st = c->set_stats[s];
+        double a = 0, m = 0;
+        if (instr) a += st.instr_accesses, m += st.instr_misses;
+        if (data) a += st.accesses - st.instr_accesses, m += st.misses - st.instr_misses;
+        hits.push_back(a - m);
+        accesses.push_back(a);
+        sum_hits += a - m;
+        sum_accesses += a;
+    }
+    
+    SampledRate result;
+    size_t n = hits.size();
+    if (sum_accesses == 0) return result;
+    result.valid = true;
+    result.rate = sum_hits / sum_accesses;
+    if (n < 2) return result;
+    
+    double residual = 0;
+    for (size_t i = 0; i < n; i++) {
+        double r = hits[i] - result.rate * accesses[i];
+        residual += r * r;
+    }
+    double mean_accesses = sum_accesses / n;
+    double fpc = 1.0 - (double)n / c->set_count;
+    double variance = fpc * residual / (n - 1) / (n * mean_accesses * mean_accesses);
+    result.half_width = 1.96 * std::sqrt(variance);
+    return result;
+}
+
+// Строка основной таблицы в режиме sampling: счётчики масштабированы на
+// set_count / sampled_count, у каждого hit rate - 95% доверительный интервал
+void print_sampled_row(const char* replacement, RiscVEmulator& emu) {
+    Cache* c = emu.cache;
+    double scale = c->sampled_count ? (double)c->set_count / c->sampled_count : 0.0;
+    SampledRate total = estimate_sampled_rate(c, true, true);
+    SampledRate instr = estimate_sampled_rate(c, true, false);
+    SampledRate data = estimate_sampled_rate(c, false, true);
+    uint64_t data_access = c->stats.data_read_access + c->stats.data_write_access;
+    uint64_t data_hit = c->stats.data_read_hit + c->stats.data_write_hit;
+    
+    printf("| %s |", replacement);
+    for (const SampledRate& r : {total, instr, data}) {
+        if (r.valid) printf(" %3.4f%% ± %.4f%% |", r.rate * 100.0, r.half_width * 100.0);
+        else printf(" nan%% |");
+    }
+    printf(" %12.0f | %12.0f | %12.0f | %12.0f |\n",
+           c->stats.instr_access * scale, c->stats.instr_hit * scale,
+           data_access * scale, data_hit * scale);
+}
+
+void print_coherence_stats(const char* replacement, RiscVEmulator& emu) {
+    for (const RiscVEmulator::Hart& h : emu.harts) {
+        const Cache* c = h.cache;
+        const Cache::CoherenceStatistics& coh = c->coh_stats;
+        uint64_t access = c->stats.instr_access + c->stats.data_read_access + c->stats.data_write_access;
+        uint64_t misses = c->stats.instr_miss + c->stats.data_read_miss + c->stats.data_write_miss;
+        printf("| %s | %4u | %12lu | %12lu | %12lu | %12lu | %12lu | %12lu | %12lu | %12lu | %12lu |\n",
+               replacement, c->hart, (unsigned long)h.instret, (unsigned long)access,
+               (unsigned long)misses, (unsigned long)coh.coherence_misses,
+               (unsigned long)coh.false_sharing, (unsigned long)coh.invalidations,
+               (unsigned long)coh.upgrades, (unsigned long)coh.transfers,
+               (unsigned long)coh.snoop_writebacks);
+    }
+}
+
+const char* tlb_policy_name(TlbPolicy policy) {
+    switch (policy) {
+        case TlbPolicy::LRU: return "lru";
+        case TlbPolicy::FIFO: return "fifo";
+        case TlbPolicy::RANDOM: return "random";
+    }
+    return "?";
+}
+
+void print_tlb_stats(const char* replacement, const Tlb& tlb) {
+    printf("| %s | %s | %4ux%-2u | %s | %8u | %12lu | %12lu | %3.4f%% | %12lu |\n",
+           replacement, tlb.name.c_str(), tlb.sets, tlb.ways, tlb_policy_name(tlb.policy),
+           (uint32_t)(tlb.reach() / 1024), (unsigned long)tlb.stats.accesses,
+           (unsigned long)tlb.stats.hits, ratio_percent(tlb.stats.hits, tlb.stats.accesses),
+           (unsigned long)tlb.stats.evictions);
+}
+
+void print_walk_stats(const char* replacement, RiscVEmulator& emu) {
+    const Mmu& mmu = *emu.mmu;
+    const Cache::Statistics& st = emu.cache->stats;
+    printf("| %s | %12lu | %12lu | %12lu | %12lu | %12lu | %3.4f%% | %12lu |\n",
+           replacement, (unsigned long)mmu.stats.walks, (unsigned long)mmu.stats.pte_reads,
+           (unsigned long)mmu.stats.megapages, (unsigned long)st.walk_access,
+           (unsigned long)st.walk_hit, ratio_percent(st.walk_hit, st.walk_access),
+           (unsigned long)mmu.stats.walk_cycles);
+}
+
+void print_pipeline_stats(const char* replacement, RiscVEmulator& emu) {
+    const Pipeline::Statistics& s = emu.pipeline->stats;
+    uint64_t stalls = s.fill + s.fetch + s.load_use + s.raw + s.execute + s.memory + s.control;
+    printf("| %s | %12lu | %12lu | %12lu | %12lu | %12lu | %12lu | %12lu | %12lu | %3.4f%% |\n", replacement,
+           (unsigned long)emu.cycles, (unsigned long)s.fill, (unsigned long)s.fetch,
+           (unsigned long)s.load_use, (unsigned long)s.raw, (unsigned long)s.execute,
+           (unsigned long)s.memory, (unsigned long)s.control, ratio_percent(stalls, emu.cycles));
+}
+
+// Предсказание не зависит от политики замещения: один прогон на отчёт
+void print_predictor_stats(RiscVEmulator& emu) {
+    const BranchUnit& bu = *emu.branch_unit;
+    for (size_t p = 0; p < bu.predictors.size(); p++) {
+        const BranchUnit::PredictorStatistics& ps = bu.predictor_stats[p];
+        printf("| %s | %12lu | %12lu | %12lu | %3.4f%% | %3.4f | %12lu | %12lu |\n",
+               bu.predictors[p]->name(), (unsigned long)bu.stats.branches,
+               (unsigned long)bu.stats.taken, (unsigned long)ps.mispredicts,
+               bu.stats.branches ? 100.0 - ratio_percent(ps.mispredicts, bu.stats.branches) : 0.0,
+               emu.instret ? (double)ps.mispredicts * 1000.0 / emu.instret : 0.0,
+               (unsigned long)ps.redirects, (unsigned long)(ps.redirects * bu.penalty));
+    }
+}
+
+void print_target_stats(RiscVEmulator& emu) {
+    const BranchUnit& bu = *emu.branch_unit;
+    printf("| %12lu | %12lu | %12lu | %3.4f%% | %12lu | %3.4f%% | %12lu |\n",
+           (unsigned long)bu.stats.jumps, (unsigned long)bu.stats.returns,
+           (unsigned long)bu.btb.size(), ratio_percent(bu.stats.btb_hits, bu.stats.btb_lookups),
+           (unsigned long)bu.ras_capacity, ratio_percent(bu.stats.ras_hits, bu.stats.returns),
+           (unsigned long)bu.stats.ras_overflows);
+}
+
+void print_branch_sites(RiscVEmulator& emu, uint32_t count) {
+    for (const BranchUnit::Site& site : emu.branch_unit->top(count)) {
+        std::string text = disassemble(emu.instruction_at(site.pc), site.pc);
+        if (!emu.symbols.empty()) text += " " + emu.symbolize(site.pc);
+        printf("| 0x%08X | %-24s | %12lu | %3.4f%% | %12lu | %3.4f%% |\n",
+               site.pc, text.c_str(), (unsigned long)site.executions,
+               ratio_percent(site.taken, site.executions), (unsigned long)site.mispredicts,
+               100.0 - ratio_percent(site.mispredicts, site.executions));
+    }
+}
+
+void print_mshr_stats(const char* replacement, RiscVEmulator& emu) {
+    const MshrFile& m = *emu.cache->mshr;
+    printf("| %s | %12u | %12lu | %12lu | %12u | %3.4f | %12lu | %12lu | %12lu | %12lu |\n",
+           replacement, m.capacity, (unsigned long)m.stats.primary, (unsigned long)m.stats.merged,
+           m.stats.peak, m.memory_parallelism(), (unsigned long)m.stats.full_stalls,
+           (unsigned long)m.stats.full_stall_cycles, (unsigned long)m.stats.data_stall_cycles,
+           (unsigned long)emu.cycles);
+}
+
+void print_mshr_occupancy(const char* replacement, RiscVEmulator& emu) {
+    const MshrFile& m = *emu.cache->mshr;
+    uint64_t total = 0;
+    for (uint64_t n : m.occupancy_cycles) total += n;
+    printf("| %s |", replacement);
+    for (uint64_t n : m.occupancy_cycles) printf(" %3.4f%% |", ratio_percent(n, total));
+    printf("\n");
+}
+
+void print_sector_stats(const char* replacement, RiscVEmulator& emu) {
+    Cache* c = emu.hierarchy.back();
+    printf("| %s | %s | %12u | %12lu | %12lu | %12lu | %12lu |\n",
+           replacement, c->name.c_str(), c->sector_size,
+           (unsigned long)c->stats.sector_misses, (unsigned long)c->stats.fill_bytes,
+           (unsigned long)c->stats.writeback_bytes, (unsigned long)c->stats.writebacks);
+}
+
+// ============================================================================
+// BATCH MODE
+// ============================================================================
+// Корпус образов на пуле потоков: у каждого образа свои эмуляторы LRU и
+// bpLRU, общий у потоков только вектор результатов (каждый пишет свой элемент)
+struct BatchResult {
+    struct Run {
+        uint64_t instret = 0;
+        uint64_t cycles = 0;
+        uint64_t access = 0;
+        uint64_t hits = 0;
+        uint64_t instr_access = 0;
+        uint64_t instr_hits = 0;
+    };
+    std::string input;
+    std::string error;              // пусто - успешно
+    Run runs[2];                    // LRU, bpLRU
+};
+
+// fn(i) для i из [0, count) на jobs потоках; индексы раздаются по одному,
+// так что долгие элементы не тормозят остальные
+template <typename Fn>
+void parallel_for(size_t count, uint32_t jobs, Fn fn) {
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) fn(i);
+    };
+    
+    std::vector<std::thread> pool;
+    for (uint32_t t = 1; t < jobs && t < count; t++) pool.emplace_back(worker);
+    worker();
+    for (std::thread& t : pool) t.join();
+}
+
+// Список входов: каталог (обычные файлы по имени) или файл со строкой на образ
+bool collect_batch_inputs(const std::string& source, std::vector<std::string>& inputs) {
+    std::error_code ec;
+    if (std::filesystem::is_directory(source, ec)) {
+        for (const auto& entry : std::filesystem::directory_iterator(source, ec)) {
+            if (entry.is_regular_file()) inputs.push_back(entry.path().string());
+        }
+        std::sort(inputs.begin(), inputs.end());
+        return !ec;
+    }
+    
+    std::ifstream list(source);
+    if (!list) return false;
+    std::string line;
+    while (std::getline(list, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        inputs.push_back(line);
+    }
+    return true;
+}
+
+void run_batch_image(const SimConfig& config, BatchResult& result) {
+    std::vector<uint8_t> image;
+    if (!read_file(result.input.c_str(), image)) throw std::runtime_error("cannot read file");
+    
+    // Образ читается с диска один раз на обе политики
+    for (int r = 0; r < 2; r++) {
+        RiscVEmulator emu(r == 0, config);
+        load_image(image, emu);
+        if (emu.mmu && emu.mmu->mapping != PageMapping::IMAGE) emu.mmu->build_page_tables(emu.memory);
+        emu.run();
+        
+        const Cache::Statistics st = emu.l1_stats();
+        BatchResult::Run& run = result.runs[r];
+        run.instret = emu.instret;
+        run.cycles = emu.cycles;
+        run.access = st.instr_access + st.data_read_access + st.data_write_access;
+        run.hits = st.instr_hit + st.data_read_hit + st.data_write_hit;
+        run.instr_access = st.instr_access;
+        run.instr_hits = st.instr_hit;
+    }
+}
+
+std::vector<BatchResult> run_batch(const SimConfig& config, const std::vector<std::string>& inputs, uint32_t jobs) {
+    std::vector<BatchResult> results(inputs.size());
+    parallel_for(inputs.size(), jobs, [&](size_t i) {
+        results[i].input = inputs[i];
+        try {
+            run_batch_image(config, results[i]);
+        } catch (const std::exception& e) {
+            // Сбой образа не прерывает пакет
+            results[i].error = e.what();
+            if (results[i].error.empty()) results[i].error = "unknown error";
+        }
+    });
+    return results;
+}
+
+void print_batch_results(const std::vector<BatchResult>& results, bool timing) {
+    const char* names[2] = {"LRU", "bpLRU"};
+    printf("| input | replacement | status | instructions | cycles | hit_rate | instr_hit_rate | data_hit_rate |\n");
+    printf("| :---- | :---------- | :----- | -----------: | -----: | -------: | -------------: | ------------: |\n");
+    for (const BatchResult& r : results) {
+        if (!r.error.empty()) {
+            printf("| %s | - | error: %s | - | - | - | - | - |\n", r.input.c_str(), r.error.c_str());
+            continue;
+        }
+        for (int p = 0; p < 2; p++) {
+            const BatchResult::Run& run = r.runs[p];
+            printf("| %s | %s | ok | %12lu | ", r.input.c_str(), names[p], (unsigned long)run.instret);
+            if (timing) printf("%12lu |", (unsigned long)run.cycles);
+            else printf("- |");
+            printf(" %3.4f%% | %3.4f%% | %3.4f%% |\n", ratio_percent(run.hits, run.access),
+                   ratio_percent(run.instr_hits, run.instr_access),
+                   ratio_percent(run.hits - run.instr_hits, run.access - run.instr_access));
+        }
+    }
+    
+    size_t failed = 0;
+    for (const BatchResult& r : results) failed += !r.error.empty();
+    printf("\n| images | ok | failed |\n");
+    printf("| -----: | -: | -----: |\n");
+    printf("| %6zu | %6zu | %6zu |\n", results.size(), results.size() - failed, failed);
+}
+
+// CSV: строка на образ и политику; ошибка - в status, числа пустые.
+// Без --timing/--pipeline такты не моделируются: cycles пустой
+bool write_batch_csv(const std::string& filename, const std::vector<BatchResult>& results, bool timing) {
+    std::ofstream file(filename);
+    if (!file) return false;
+    
+    const char* names[2] = {"LRU", "bpLRU"};
+    file << "input,replacement,status,instructions,cycles,accesses,hits,instr_accesses,instr_hits\n";
+    for (const BatchResult& r : results) {
+        std::string input = "\"" + r.input + "\"";
+        if (!r.error.empty()) {
+            std::string error = r.error;
+            std::replace(error.begin(), error.end(), '"', '\'');
+            file << input << ",,\"error: " << error << "\",,,,,,\n";
+            continue;
+        }
+        for (int p = 0; p < 2; p++) {
+            const BatchResult::Run& run = r.runs[p];
+            file << input << "," << names[p] << ",ok," << run.instret << ",";
+            if (timing) file << run.cycles;
+            file << "," << run.access << "," << run.hits << "," << run.instr_access << "," << run.instr_hits << "\n";
+        }
+    }
+    return true;
+}
+
+// ============================================================================
+// DESIGN-SPACE SWEEP
+// ============================================================================
+// Программа исполняется один раз, записанный поток обращений L1 проигрывается
+// на каждой точке декартова произведения параметров. Размер линии у Cache -
+// константа компиляции, поэтому точки считает компактная tag-only модель
+// одного уровня с той же заменой (LRU-счётчики, дерево bpLRU) и записью
+class SweepCache {
+public:
+    struct Statistics {
+        uint64_t instr_access = 0;
+        uint64_t instr_hit = 0;
+        uint64_t data_access = 0;
+        uint64_t data_hit = 0;
+        uint64_t write_access = 0;      // входят в data
+        uint64_t write_hit = 0;
+        uint64_t writebacks = 0;
+        uint64_t fills = 0;
+    } stats;
+    
+    SweepCache(uint32_t sets, uint32_t way_count, uint32_t line_size, bool lru,
+               WritePolicy policy, WriteMissPolicy miss, const LatencyConfig& latency)
+        : set_count(sets), ways(way_count), offset_len(log2_exact(line_size)), use_lru(lru),
+          write_policy(policy), write_miss(miss),
+          memory_latency(latency.memory), writeback_latency(latency.writeback),
+          tags((size_t)sets * way_count, INVALID),
+          dirty((size_t)sets * way_count, 0), lru_counters((size_t)sets * way_count, 0),
+          plru_bits(sets, 0), path_mask(way_count, 0), path_bits(way_count, 0) {
+        for (uint32_t way = 0; way < ways; way++) {
+            for (uint32_t node = way + ways - 1; node > 0; node = (node - 1) / 2) {
+                uint32_t parent = (node - 1) / 2;
+                path_mask[way] |= 1ull << parent;
+                if (node == 2 * parent + 1) path_bits[way] |= 1ull << parent;
             }
-            default:
-                if (g_debug) printf("[EXEC] Unknown opcode: 0x%02X\n", opcode);
-                pc += 4;
-                break;
         }
-        
-        regs[0] = 0;
     }
     
-    void run() {
-        uint64_t instruction_count = 0;
-        const uint64_t MAX_INSTRUCTIONS = 1000000;
+    // Статистика копии, проигравшей другие наборы той же трассы
+    void merge(const SweepCache& other) {
+        stats.instr_access += other.stats.instr_access;
+        stats.instr_hit += other.stats.instr_hit;
+        stats.data_access += other.stats.data_access;
+        stats.data_hit += other.stats.data_hit;
+        stats.write_access += other.stats.write_access;
+        stats.write_hit += other.stats.write_hit;
+        stats.writebacks += other.stats.writebacks;
+        stats.fills += other.stats.fills;
+    }
+    
+    // Такты сверх попадания, как last_latency - hit_latency у Cache
+    uint32_t access(const TraceRecord& r) {
+        uint32_t block = r.addr >> offset_len;
+        uint32_t set_idx = block & (set_count - 1);
+        bool is_write = r.type == AccessType::WRITE;
+        bool is_instr = r.type == AccessType::INSTR;
+        // Счётчики без ветвлений: тип обращения в трассе плохо предсказуем
+        stats.instr_access += is_instr;
+        stats.data_access += !is_instr;
+        stats.write_access += is_write;
         
-        while (pc != initial_ra && instruction_count < MAX_INSTRUCTIONS) {
-            uint32_t instr = fetch();
-            execute(instr);
-            instruction_count++;
+        uint32_t latency = 0;
+        int way = find_way(set_idx, block);
+        if (way != -1) {
+            stats.instr_hit += is_instr;
+            stats.data_hit += !is_instr;
+            stats.write_hit += is_write;
+            touch(set_idx, way);
+            if (!is_write) return 0;
+            if (write_policy == WritePolicy::WRITE_BACK) dirty[set_idx * ways + way] = 1;
+            else latency += writeback_latency;
+            if (write_miss == WriteMissPolicy::AROUND) latency += evict(set_idx, way);
+            return latency;
         }
         
-        if (instruction_count >= MAX_INSTRUCTIONS) {
-            std::cerr << "Warning: Reached max instruction limit (" << MAX_INSTRUCTIONS << ")" << std::endl;
-            std::cerr << "PC = 0x" << std::hex << pc << ", initial_ra = 0x" << initial_ra << std::dec << std::endl;
-        }
+        if (is_write && write_miss != WriteMissPolicy::ALLOCATE) return writeback_latency;
         
-        if (g_debug) {
-            printf("\n[RUN] Executed %lu instructions\n", instruction_count);
+        uint32_t victim = use_lru ? find_lru_victim(set_idx) : find_plru_victim(set_idx);
+        latency += evict(set_idx, victim) + memory_latency;
+        stats.fills++;
+        size_t line = (size_t)set_idx * ways + victim;
+        tags[line] = block;
+        touch(set_idx, victim);
+        if (is_write) {
+            if (write_policy == WritePolicy::WRITE_BACK) dirty[line] = 1;
+            else latency += writeback_latency;
         }
-        
-        cache->flush();
+        return latency;
+    }
+    
+private:
+    uint32_t set_count;
+    uint32_t ways;
+    uint32_t offset_len;
+    bool use_lru;
+    WritePolicy write_policy;
+    WriteMissPolicy write_miss;
+    uint32_t memory_latency;
+    uint32_t writeback_latency;
+    // Номер блока целиком; INVALID - пустая линия (номер блока меньше 2^30)
+    static const uint32_t INVALID = ~0u;
+    std::vector<uint32_t> tags;
+    std::vector<uint8_t> dirty;
+    std::vector<uint64_t> lru_counters;
+    std::vector<uint64_t> plru_bits;    // ways - 1 бит дерева на набор
+    std::vector<uint64_t> path_mask;    // узлы дерева на пути к way
+    std::vector<uint64_t> path_bits;    // их значения после обращения к way
+    uint64_t global_counter = 0;
+    
+    // Сравнение всего набора сразу: номер совпавшего way плохо предсказуем
+    int find_way(uint32_t set_idx, uint32_t block) {
+        uint64_t hits = match_tags(&tags[(size_t)set_idx * ways], ways, block);
+        return hits ? __builtin_ctzll(hits) : -1;
+    }
+    
+    // У пустой линии счётчик LRU нулевой: минимум сам находит первую пустую
+    uint32_t find_lru_victim(uint32_t set_idx) {
+        const uint64_t* counters = &lru_counters[(size_t)set_idx * ways];
+        return std::min_element(counters, counters + ways) - counters;
+    }
+    
+    uint32_t find_plru_victim(uint32_t set_idx) {
+        int free_way = find_way(set_idx, INVALID);
+        if (free_way != -1) return free_way;
+        uint64_t bits = plru_bits[set_idx];
+        uint32_t node = 0;
+        while (node < ways - 1) node = 2 * node + 1 + ((bits >> node) & 1);
+        return node - (ways - 1);
     }
+    
+    void touch(uint32_t set_idx, uint32_t way) {
+        if (use_lru) {
+            lru_counters[(size_t)set_idx * ways + way] = ++global_counter;
+            return;
+        }
+        plru_bits[set_idx] = (plru_bits[set_idx] & ~path_mask[way]) | path_bits[way];
+    }
+    
+    uint32_t evict(uint32_t set_idx, uint32_t way) {
+        size_t line = (size_t)set_idx * ways + way;
+        bool was_dirty = dirty[line];
+        tags[line] = INVALID;
+        lru_counters[line] = 0;
+        dirty[line] = 0;
+        if (!was_dirty) return 0;
+        stats.writebacks++;
+        return writeback_latency;
+    }
+};
+
+struct SweepWrite {
+    std::string name;               // как у --write
+    WritePolicy policy;
+    WriteMissPolicy miss;
+};
+
+// Оси перебора; пустая ось берёт значение из обычной конфигурации L1
+struct SweepSpec {
+    std::vector<uint32_t> sizes;
+    std::vector<uint32_t> lines;
+    std::vector<uint32_t> ways;
+    std::vector<bool> policies;         // true - LRU
+    std::vector<SweepWrite> writes;
+};
+
+struct SweepPoint {
+    uint32_t size;
+    uint32_t line;
+    uint32_t ways;
+    bool lru;
+    SweepWrite write;
+    SweepCache::Statistics stats;
+    uint64_t extra_cycles = 0;
 };
 
+// Точки декартова произведения; несуществующие геометрии пропускаются
+// с сообщением в stderr
+std::vector<SweepPoint> enumerate_sweep(const SweepSpec& spec, const SimConfig& config) {
+    const CacheConfig& l1 = config.levels[0];
+    std::vector<uint32_t> sizes = spec.sizes, lines = spec.lines, ways = spec.ways;
+    std::vector<bool> policies = spec.policies;
+    std::vector<SweepWrite> writes = spec.writes;
+    if (sizes.empty()) sizes.push_back(l1.set_count * l1.ways * CACHE_LINE_SIZE);
+    if (lines.empty()) lines.push_back(CACHE_LINE_SIZE);
+    if (ways.empty()) ways.push_back(l1.ways);
+    if (policies.empty()) policies = {true, false};
+    if (writes.empty()) writes.push_back({"default", l1.write_policy, l1.write_miss});
+    
+    std::vector<SweepPoint> points;
+    for (uint32_t size : sizes) {
+        for (uint32_t line : lines) {
+            for (uint32_t w : ways) {
+                const char* invalid = nullptr;
+                if (!is_power_of_two(size) || !is_power_of_two(line) || !is_power_of_two(w)) {
+                    invalid = "not a power of two";
+                } else if (line < 4) {
+                    invalid = "line is below 4 bytes";
+                } else if (w > 64) {
+                    invalid = "more than 64 ways";
+                } else if (size > MEMORY_SIZE) {
+                    invalid = "larger than memory";
+                } else if (size < line * w) {
+                    invalid = "smaller than one set";
+                }
+                if (invalid) {
+                    std::cerr << "Skipping sweep point size=" << size << " line=" << line << " ways=" << w
+                              << ": " << invalid << std::endl;
+                    continue;
+                }
+                for (bool lru : policies) {
+                    for (const SweepWrite& write : writes) {
+                        SweepPoint point;
+                        point.size = size;
+                        point.line = line;
+                        point.ways = w;
+                        point.lru = lru;
+                        point.write = write;
+                        points.push_back(point);
+                    }
+                }
+            }
+        }
+    }
+    return points;
+}
+
+void run_sweep(std::vector<SweepPoint>& points, const std::vector<TraceRecord>& trace,
+               const SimConfig& config, uint32_t jobs) {
+    parallel_for(points.size(), jobs, [&](size_t i) {
+        SweepPoint& point = points[i];
+        SweepCache cache(point.size / (point.line * point.ways), point.ways, point.line, point.lru,
+                         point.write.policy, point.write.miss, config.latency);
+        for (const TraceRecord& r : trace) point.extra_cycles += cache.access(r);
+        point.stats = cache.stats;
+    });
+}
+
+// Статистика SweepCache в L1 эмулятора: отчёт --trace печатается как обычно
+void load_sweep_stats(RiscVEmulator& emu, const SweepCache& cache, uint64_t instret) {
+    const SweepCache::Statistics& s = cache.stats;
+    Cache::Statistics& st = emu.cache->stats;
+    st.instr_access = s.instr_access;
+    st.instr_hit = s.instr_hit;
+    st.instr_miss = s.instr_access - s.instr_hit;
+    st.data_read_access = s.data_access - s.write_access;
+    st.data_read_hit = s.data_hit - s.write_hit;
+    st.data_read_miss = st.data_read_access - st.data_read_hit;
+    st.data_write_access = s.write_access;
+    st.data_write_hit = s.write_hit;
+    st.data_write_miss = s.write_access - s.write_hit;
+    st.writebacks = s.writebacks;
+    st.fill_bytes = s.fills * CACHE_LINE_SIZE;
+    st.writeback_bytes = s.writebacks * CACHE_LINE_SIZE;
+    emu.instret = instret;
+}
+
+// --trace для одного уровня без дополнительных механизмов: Cache не нужен,
+// обе политики считает SweepCache за один проход по трассе. Наборы независимы,
+// поэтому на нескольких ядрах трасса разбирается один раз, записи пачками
+// раскладываются по долям наборов, и каждый поток проигрывает свою долю
+void replay_trace_sweep(const MappedFile& file, const SimConfig& config, uint32_t jobs,
+                        RiscVEmulator& emu_lru, RiscVEmulator& emu_plru) {
+    const CacheConfig& l1 = config.levels[0];
+    uint32_t shards = 1;
+    while (shards * 2 <= std::min(jobs, l1.set_count)) shards *= 2;
+    const size_t batch_records = 1 << 18;   // записей между раздачами потокам
+    
+    struct Shard {
+        SweepCache lru, plru;
+        std::vector<TraceRecord> batch;
+    };
+    SweepCache lru(l1.set_count, l1.ways, CACHE_LINE_SIZE, true, l1.write_policy, l1.write_miss, config.latency);
+    SweepCache plru(l1.set_count, l1.ways, CACHE_LINE_SIZE, false, l1.write_policy, l1.write_miss, config.latency);
+    std::vector<Shard> results(shards, Shard{lru, plru, {}});
+    
+    size_t pending = 0;
+    auto replay_batches = [&]() {
+        parallel_for(shards, jobs, [&](size_t i) {
+            Shard& shard = results[i];
+            for (const TraceRecord& r : shard.batch) {
+                shard.lru.access(r);
+                shard.plru.access(r);
+            }
+            shard.batch.clear();
+        });
+        pending = 0;
+    };
+    
+    uint64_t instret = 0;
+    for_each_trace_record(file, [&](const TraceRecord& r) {
+        instret += r.type == AccessType::INSTR;
+        if (shards == 1) {
+            results[0].lru.access(r);
+            results[0].plru.access(r);
+            return;
+        }
+        results[(r.addr >> CACHE_OFFSET_LEN) & (shards - 1)].batch.push_back(r);
+        if (++pending == batch_records) replay_batches();
+    });
+    if (pending > 0) replay_batches();
+    
+    for (size_t i = 1; i < shards; i++) {
+        results[0].lru.merge(results[i].lru);
+        results[0].plru.merge(results[i].plru);
+    }
+    load_sweep_stats(emu_lru, results[0].lru, instret);
+    load_sweep_stats(emu_plru, results[0].plru, instret);
+}
+
+// base_cycles - такты записанного прогона без задержек сверх попадания в L1
+void write_sweep_csv(std::ostream& out, const std::vector<SweepPoint>& points, bool timing,
+                     uint64_t instret, uint64_t base_cycles) {
+    out << "size,line,ways,sets,policy,write,accesses,hits,hit_rate,instr_hit_rate,data_hit_rate,"
+        << "writebacks,fills";
+    if (timing) out << ",cycles,cpi";
+    out << "\n";
+    
+    char buf[64];
+    for (const SweepPoint& p : points) {
+        const SweepCache::Statistics& st = p.stats;
+        uint64_t access = st.instr_access + st.data_access;
+        uint64_t hits = st.instr_hit + st.data_hit;
+        out << p.size << "," << p.line << "," << p.ways << "," << p.size / (p.line * p.ways) << ","
+            << (p.lru ? "LRU" : "bpLRU") << "," << p.write.name << "," << access << "," << hits;
+        snprintf(buf, sizeof(buf), ",%.4f,%.4f,%.4f", ratio_percent(hits, access),
+                 ratio_percent(st.instr_hit, st.instr_access), ratio_percent(st.data_hit, st.data_access));
+        out << buf << "," << st.writebacks << "," << st.fills;
+        if (timing) {
+            uint64_t cycles = base_cycles + p.extra_cycles;
+            snprintf(buf, sizeof(buf), ",%.4f", instret ? (double)cycles / instret : 0.0);
+            out << "," << cycles << buf;
+        }
+        out << "\n";
+    }
+}
+
 // ============================================================================
-// FILE I/O
+// MAIN
 // ============================================================================
-bool read_input_file(const char* filename, RiscVEmulator& emu) {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file) return false;
-    
-    file.read((char*)&emu.pc, 4);
-    for (int i = 1; i < 32; i++) {
-        file.read((char*)&emu.regs[i], 4);
+// Начальное состояние: входной файл или checkpoint (суффикс _lru / _bplru)
+bool prepare_emulator(RiscVEmulator& emu, const std::string& input_file,
+                      const std::string& checkpoint, const char* suffix) {
+    if (!checkpoint.empty()) {
+        std::string filename = with_suffix(checkpoint, suffix);
+        if (!load_checkpoint(filename, emu)) {
+            std::cerr << "Failed to read checkpoint: " << filename << std::endl;
+            return false;
+        }
+        return true;
     }
-    emu.initial_ra = emu.regs[1];
+    if (!read_input_file(input_file.c_str(), emu)) {
+        std::cerr << "Failed to read input file: " << input_file << std::endl;
+        return false;
+    }
+    if (emu.mmu && emu.mmu->mapping != PageMapping::IMAGE) emu.mmu->build_page_tables(emu.memory);
+    return true;
+}
+
+// Формат: <sets>x<ways>[:inclusive|exclusive|nine], например 64x8:inclusive
+bool parse_level_spec(const char* spec, CacheConfig& level) {
+    char policy[16] = "nine";
+    int fields = sscanf(spec, "%ux%u:%15s", &level.set_count, &level.ways, policy);
+    if (fields < 2) return false;
     
-    while (file.peek() != EOF) {
-        uint32_t addr, size;
-        file.read((char*)&addr, 4);
-        file.read((char*)&size, 4);
+    if (strcmp(policy, "inclusive") == 0) level.inclusion = InclusionPolicy::INCLUSIVE;
+    else if (strcmp(policy, "exclusive") == 0) level.inclusion = InclusionPolicy::EXCLUSIVE;
+    else if (strcmp(policy, "nine") == 0) level.inclusion = InclusionPolicy::NINE;
+    else return false;
+    return true;
+}
+
+// Формат: key=value[,key=value...]; ключи l1, l2, ... (hit latency уровней),
+// mem, wb, alu, mul, div, load, store, branch, jump, system
+bool parse_latency_spec(const std::string& spec, SimConfig& config) {
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t end = spec.find(',', pos);
+        if (end == std::string::npos) end = spec.size();
+        std::string item = spec.substr(pos, end - pos);
+        pos = end + 1;
+        
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) return false;
+        std::string key = item.substr(0, eq);
+        uint32_t value = strtoul(item.c_str() + eq + 1, nullptr, 0);
+        LatencyConfig& lat = config.latency;
         
-        for (uint32_t i = 0; i < size; i++) {
-            uint8_t byte;
-            file.read((char*)&byte, 1);
-            emu.memory.write8(addr + i, byte);
+        if (key.size() > 1 && key[0] == 'l' && isdigit((unsigned char)key[1])) {
+            uint32_t level = strtoul(key.c_str() + 1, nullptr, 10);
+            if (level == 0 || level > config.levels.size()) return false;
+            config.levels[level - 1].hit_latency = value;
         }
+        else if (key == "mem") lat.memory = value;
+        else if (key == "wb") lat.writeback = value;
+        else if (key == "alu") lat.alu = value;
+        else if (key == "mul") lat.mul = value;
+        else if (key == "div") lat.div = value;
+        else if (key == "load") lat.load = value;
+        else if (key == "store") lat.store = value;
+        else if (key == "branch") lat.branch = value;
+        else if (key == "jump") lat.jump = value;
+        else if (key == "system") lat.system = value;
+        else if (key == "victim") lat.victim = value;
+        else if (key == "c2c") lat.transfer = value;
+        else if (key == "mispredict") lat.mispredict = value;
+        else return false;
     }
+    return true;
+}
+
+// Формат: <predictor>[,<predictor>...][:table_bits[:history_bits]]
+bool parse_bpred_spec(const char* spec, BranchConfig& branch) {
+    char list[64] = "";
+    if (sscanf(spec, "%63[^:]:%u:%u", list, &branch.table_bits, &branch.history_bits) < 1) return false;
+    if (branch.table_bits == 0 || branch.table_bits > 24 || branch.history_bits > 31) return false;
     
-    if (g_debug) {
-        printf("[FILE] Loaded: PC=0x%08X, RA=0x%08X\n", emu.pc, emu.initial_ra);
+    branch.predictors.clear();
+    for (char* name = strtok(list, ","); name; name = strtok(nullptr, ",")) {
+        if (strcmp(name, "static") == 0) branch.predictors.push_back(PredictorType::STATIC);
+        else if (strcmp(name, "bimodal") == 0) branch.predictors.push_back(PredictorType::BIMODAL);
+        else if (strcmp(name, "gshare") == 0) branch.predictors.push_back(PredictorType::GSHARE);
+        else if (strcmp(name, "tage") == 0) branch.predictors.push_back(PredictorType::TAGE);
+        else return false;
     }
+    return !branch.predictors.empty();
+}
+
+// Формат: <entries>[:<ways>[:lru|fifo|random]]
+bool parse_tlb_spec(const char* spec, TlbConfig& tlb) {
+    char policy[16] = "lru";
+    tlb.ways = 0;
+    if (sscanf(spec, "%u:%u:%15s", &tlb.entries, &tlb.ways, policy) < 1) return false;
+    if (tlb.ways == 0) tlb.ways = tlb.entries;
     
+    if (strcmp(policy, "lru") == 0) tlb.policy = TlbPolicy::LRU;
+    else if (strcmp(policy, "fifo") == 0) tlb.policy = TlbPolicy::FIFO;
+    else if (strcmp(policy, "random") == 0) tlb.policy = TlbPolicy::RANDOM;
+    else return false;
     return true;
 }
 
-bool write_output_file(const char* filename, RiscVEmulator& emu, 
-                       uint32_t start_addr, uint32_t size) {
-    std::ofstream file(filename, std::ios::binary);
-    if (!file) return false;
+// Формат: <root>[:identity|mega]
+bool parse_sv32_spec(const char* spec, SimConfig& config) {
+    char mapping[16] = "";
+    if (sscanf(spec, "%i:%15s", (int*)&config.page_table_root, mapping) < 1) return false;
     
-    file.write((char*)&emu.pc, 4);
-    for (int i = 1; i < 32; i++) {
-        file.write((char*)&emu.regs[i], 4);
-    }
+    if (mapping[0] == '\0') config.page_mapping = PageMapping::IMAGE;
+    else if (strcmp(mapping, "identity") == 0) config.page_mapping = PageMapping::IDENTITY;
+    else if (strcmp(mapping, "mega") == 0) config.page_mapping = PageMapping::IDENTITY_MEGA;
+    else return false;
+    config.sv32 = true;
+    return true;
+}
+
+// Формат: next-line|stride|stream[:degree[:delay]]
+bool parse_prefetch_spec(const char* spec, PrefetchConfig& prefetch) {
+    char type[16] = "";
+    uint32_t degree = prefetch.degree;
+    uint32_t delay = prefetch.delay;
+    if (sscanf(spec, "%15[^:]:%u:%u", type, &degree, &delay) < 1) return false;
     
-    file.write((char*)&start_addr, 4);
-    file.write((char*)&size, 4);
-    for (uint32_t i = 0; i < size; i++) {
-        uint8_t byte = emu.memory.read8(start_addr + i);
-        file.write((char*)&byte, 1);
+    if (strcmp(type, "next-line") == 0) prefetch.type = PrefetcherType::NEXT_LINE;
+    else if (strcmp(type, "stride") == 0) prefetch.type = PrefetcherType::STRIDE;
+    else if (strcmp(type, "stream") == 0) prefetch.type = PrefetcherType::STREAM;
+    else return false;
+    
+    if (degree == 0) return false;
+    prefetch.degree = degree;
+    prefetch.delay = delay;
+    return true;
+}
+
+// Формат: back|through[:allocate|no-allocate|around]; по умолчанию
+// write-back + allocate и write-through + no-allocate
+bool parse_write_spec(const char* spec, CacheConfig& level) {
+    char policy[16] = "";
+    char miss[16] = "";
+    if (sscanf(spec, "%15[^:]:%15s", policy, miss) < 1) return false;
+    
+    if (strcmp(policy, "back") == 0) {
+        level.write_policy = WritePolicy::WRITE_BACK;
+        level.write_miss = WriteMissPolicy::ALLOCATE;
+    } else if (strcmp(policy, "through") == 0) {
+        level.write_policy = WritePolicy::WRITE_THROUGH;
+        level.write_miss = WriteMissPolicy::NO_ALLOCATE;
+    } else {
+        return false;
     }
     
+    if (miss[0] == '\0') return true;
+    if (strcmp(miss, "allocate") == 0) level.write_miss = WriteMissPolicy::ALLOCATE;
+    else if (strcmp(miss, "no-allocate") == 0) level.write_miss = WriteMissPolicy::NO_ALLOCATE;
+    else if (strcmp(miss, "around") == 0) level.write_miss = WriteMissPolicy::AROUND;
+    else return false;
+    return true;
+}
+
+// Числа через запятую; a-b - степени двойки от a до b; суффиксы K и M
+bool parse_sweep_values(const std::string& text, std::vector<uint32_t>& values) {
+    auto parse_number = [](const std::string& item, uint32_t& value) {
+        char* end = nullptr;
+        unsigned long v = strtoul(item.c_str(), &end, 0);
+        if (end == item.c_str()) return false;
+        if (*end == 'K' || *end == 'k') { v *= 1024; end++; }
+        else if (*end == 'M' || *end == 'm') { v *= 1024 * 1024; end++; }
+        if (*end != '\0' || v == 0 || v > 0xFFFFFFFFul) return false;
+        value = (uint32_t)v;
+        return true;
+    };
+    
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t comma = text.find(',', start);
+        if (comma == std::string::npos) comma = text.size();
+        std::string item = text.substr(start, comma - start);
+        size_t dash = item.find('-');
+        uint32_t low, high;
+        if (dash == std::string::npos) {
+            if (!parse_number(item, low)) return false;
+            values.push_back(low);
+        } else {
+            if (!parse_number(item.substr(0, dash), low) || !parse_number(item.substr(dash + 1), high) ||
+                low > high) {
+                return false;
+            }
+            for (uint64_t v = low; v <= high; v *= 2) values.push_back((uint32_t)v);
+        }
+        start = comma + 1;
+    }
+    return true;
+}
+
+// Формат: <axis>=<values>[;<axis>=<values>...], оси size, line, ways, policy, write
+bool parse_sweep_spec(const char* spec, SweepSpec& sweep) {
+    std::string text = spec;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find(';', start);
+        if (end == std::string::npos) end = text.size();
+        std::string axis = text.substr(start, end - start);
+        start = end + 1;
+        
+        size_t eq = axis.find('=');
+        if (eq == std::string::npos) return false;
+        std::string key = axis.substr(0, eq);
+        std::string values = axis.substr(eq + 1);
+        if (key == "size") {
+            if (!parse_sweep_values(values, sweep.sizes)) return false;
+        } else if (key == "line") {
+            if (!parse_sweep_values(values, sweep.lines)) return false;
+        } else if (key == "ways") {
+            if (!parse_sweep_values(values, sweep.ways)) return false;
+        } else if (key == "policy") {
+            for (size_t p = 0; p <= values.size();) {
+                size_t comma = values.find(',', p);
+                if (comma == std::string::npos) comma = values.size();
+                std::string name = values.substr(p, comma - p);
+                if (name == "lru") sweep.policies.push_back(true);
+                else if (name == "bplru") sweep.policies.push_back(false);
+                else return false;
+                p = comma + 1;
+            }
+        } else if (key == "write") {
+            for (size_t p = 0; p <= values.size();) {
+                size_t comma = values.find(',', p);
+                if (comma == std::string::npos) comma = values.size();
+                std::string name = values.substr(p, comma - p);
+                CacheConfig probe;
+                if (!parse_write_spec(name.c_str(), probe)) return false;
+                sweep.writes.push_back({name, probe.write_policy, probe.write_miss});
+                p = comma + 1;
+            }
+        } else {
+            return false;
+        }
+    }
     return true;
 }
 
-// ============================================================================
-// MAIN
-// ============================================================================
 int main(int argc, char* argv[]) {
     std::string input_file;
     std::string output_file;
     uint32_t output_addr = 0;
     uint32_t output_size = 0;
     bool has_output = false;
+    SimConfig config;
+    std::vector<std::string> latency_specs;
+    bool report_traffic = false;
+    std::string heat_file;
+    std::string save_file;
+    std::string load_file;
+    uint64_t stop_after = 0;
+    std::string batch_source;
+    std::string trace_file;
+    std::string record_file;
+    std::string csv_file;
+    SweepSpec sweep;
+    bool sweep_enabled = false;
+    uint32_t jobs = std::max(1u, std::thread::hardware_concurrency());
     
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
@@ -690,64 +5562,398 @@ int main(int argc, char* argv[]) {
             has_output = true;
         } else if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--debug") == 0) {
             g_debug = true;
+        } else if (strcmp(argv[i], "--level") == 0 && i + 1 < argc) {
+            CacheConfig level;
+            level.name = "L" + std::to_string(config.levels.size() + 1);
+            level.hit_latency = config.levels.size() == 1 ? 10 : 30;
+            if (!parse_level_spec(argv[++i], level)) {
+                std::cerr << "Invalid cache level: " << argv[i] << std::endl;
+                return 1;
+            }
+            config.levels.push_back(level);
+        } else if (strcmp(argv[i], "--prefetch") == 0 && i + 1 < argc) {
+            if (!parse_prefetch_spec(argv[++i], config.prefetch)) {
+                std::cerr << "Invalid prefetcher: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--victim") == 0 && i + 1 < argc) {
+            config.levels[0].victim_entries = strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--write") == 0 && i + 1 < argc) {
+            if (!parse_write_spec(argv[++i], config.levels[0])) {
+                std::cerr << "Invalid write policy: " << argv[i] << std::endl;
+                return 1;
+            }
+            report_traffic = true;
+        } else if (strcmp(argv[i], "--wbuf") == 0 && i + 1 < argc) {
+            config.write_buffer = strtoul(argv[++i], nullptr, 0);
+            report_traffic = true;
+        } else if (strcmp(argv[i], "--pc-profile") == 0 && i + 1 < argc) {
+            config.pc_profile = strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--heatmap") == 0 && i + 1 < argc) {
+            // <file.csv|file.pgm>[:interval]
+            heat_file = argv[++i];
+            config.heat_interval = 1000;
+            size_t colon = heat_file.find_last_of(':');
+            if (colon != std::string::npos) {
+                config.heat_interval = strtoul(heat_file.c_str() + colon + 1, nullptr, 0);
+                heat_file.resize(colon);
+            }
+            if (config.heat_interval == 0 || heat_file.empty()) {
+                std::cerr << "Invalid heat map: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--save-checkpoint") == 0 && i + 1 < argc) {
+            save_file = argv[++i];
+        } else if (strcmp(argv[i], "--load-checkpoint") == 0 && i + 1 < argc) {
+            load_file = argv[++i];
+        } else if (strcmp(argv[i], "--stop-after") == 0 && i + 1 < argc) {
+            stop_after = strtoull(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--sample") == 0 && i + 1 < argc) {
+            // <k> - каждый k-й набор L1; random:<count>[:seed] - случайные наборы
+            const char* spec = argv[++i];
+            if (strncmp(spec, "random:", 7) == 0) {
+                if (sscanf(spec + 7, "%u:%u", &config.sample_random, &config.sample_seed) < 1) {
+                    config.sample_random = 0;
+                }
+            } else {
+                config.sample_every = strtoul(spec, nullptr, 0);
+            }
+            if (config.sample_every == 0 && config.sample_random == 0) {
+                std::cerr << "Invalid set sampling: " << spec << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--bpred") == 0 && i + 1 < argc) {
+            if (!parse_bpred_spec(argv[++i], config.branch)) {
+                std::cerr << "Invalid branch predictor spec: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--btb") == 0 && i + 1 < argc) {
+            config.branch.btb_entries = strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--ras") == 0 && i + 1 < argc) {
+            config.branch.ras_entries = strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--sv32") == 0 && i + 1 < argc) {
+            if (!parse_sv32_spec(argv[++i], config)) {
+                std::cerr << "Invalid sv32 spec: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if ((strcmp(argv[i], "--itlb") == 0 || strcmp(argv[i], "--dtlb") == 0) && i + 1 < argc) {
+            TlbConfig& tlb = argv[i][2] == 'i' ? config.itlb : config.dtlb;
+            if (!parse_tlb_spec(argv[++i], tlb)) {
+                std::cerr << "Invalid TLB spec: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--harts") == 0 && i + 1 < argc) {
+            // <count>[:mesi|moesi]
+            char protocol[16] = "mesi";
+            if (sscanf(argv[++i], "%u:%15s", &config.harts, protocol) < 1 || config.harts == 0 ||
+                (strcmp(protocol, "mesi") != 0 && strcmp(protocol, "moesi") != 0)) {
+                std::cerr << "Invalid harts spec: " << argv[i] << std::endl;
+                return 1;
+            }
+            if (strcmp(protocol, "moesi") == 0) config.coherence = CoherenceProtocol::MOESI;
+        } else if (strcmp(argv[i], "--mshr") == 0 && i + 1 < argc) {
+            char* end = nullptr;
+            unsigned long entries = strtoul(argv[++i], &end, 0);
+            if (*end != '\0' || entries == 0 || entries > 64) {     // отчёт занятости: колонка на каждое n
+                std::cerr << "Invalid MSHR count: " << argv[i] << " (expected 1..64)" << std::endl;
+                return 1;
+            }
+            config.mshr_entries = entries;
+        } else if (strcmp(argv[i], "--sector") == 0 && i + 1 < argc) {
+            config.sector_size = strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--reuse") == 0) {
+            config.reuse_distance = true;
+        } else if (strcmp(argv[i], "--3c") == 0) {
+            config.classify_misses = true;
+        } else if (strcmp(argv[i], "--tag-only") == 0) {
+            config.tag_only = true;
+        } else if (strcmp(argv[i], "--timing") == 0) {
+            config.latency.enabled = true;
+        } else if (strcmp(argv[i], "--pipeline") == 0) {
+            config.pipeline = true;
+            config.latency.enabled = true;
+        } else if (strcmp(argv[i], "--sweep") == 0 && i + 1 < argc) {
+            if (!parse_sweep_spec(argv[++i], sweep)) {
+                std::cerr << "Invalid sweep spec: " << argv[i] << std::endl;
+                return 1;
+            }
+            sweep_enabled = true;
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_file = argv[++i];
+        } else if (strcmp(argv[i], "--record-trace") == 0 && i + 1 < argc) {
+            record_file = argv[++i];
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_source = argv[++i];
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = std::max(1ul, strtoul(argv[++i], nullptr, 0));
+        } else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            csv_file = argv[++i];
+        } else if (strcmp(argv[i], "--no-forwarding") == 0) {
+            config.forwarding = false;
+        } else if (strcmp(argv[i], "--lat") == 0 && i + 1 < argc) {
+            config.latency.enabled = true;
+            latency_specs.push_back(argv[++i]);
+        }
+    }
+    
+    // Задержки применяются после разбора всех --level
+    for (const std::string& spec : latency_specs) {
+        if (!parse_latency_spec(spec, config)) {
+            std::cerr << "Invalid latency spec: " << spec << std::endl;
+            return 1;
+        }
+    }
+    
+    if (!batch_source.empty()) {
+        // Отчёты и файлы одного прогона в пакетном режиме не имеют смысла
+        if (!input_file.empty() || !load_file.empty() || !save_file.empty() || has_output ||
+            !heat_file.empty() || stop_after > 0 || !record_file.empty() || !trace_file.empty() ||
+            sweep_enabled) {
+            std::cerr << "--batch cannot be combined with -i, -o, checkpoints, --heatmap, --stop-after,"
+                      << " --record-trace, --trace or --sweep" << std::endl;
+            return 1;
+        }
+        std::vector<std::string> inputs;
+        if (!collect_batch_inputs(batch_source, inputs)) {
+            std::cerr << "Failed to read batch list: " << batch_source << std::endl;
+            return 1;
+        }
+        std::vector<BatchResult> results = run_batch(config, inputs, jobs);
+        if (!csv_file.empty()) {
+            if (!write_batch_csv(csv_file, results, config.latency.enabled)) {
+                std::cerr << "Failed to write CSV: " << csv_file << std::endl;
+                return 1;
+            }
+        } else {
+            print_batch_results(results, config.latency.enabled);
         }
+        // Остальные образы досчитываются, но сбой любого виден по коду возврата
+        bool failed = false;
+        for (const BatchResult& r : results) {
+            if (r.error.empty()) continue;
+            std::cerr << r.input << ": " << r.error << std::endl;
+            failed = true;
+        }
+        return failed ? 1 : 0;
+    }
+    
+    if (!input_file.empty() + !load_file.empty() + !trace_file.empty() != 1) {
+        std::cerr << "Usage: " << argv[0] << " -i <input_file|elf32> | --load-checkpoint <file> [-o <output_file> <start_addr> <size>] [-d]"
+                  << " [--level <sets>x<ways>[:inclusive|exclusive|nine]]..."
+                  << " [--timing] [--pipeline [--no-forwarding]] [--lat <key>=<cycles>[,...]] [--tag-only]"
+                  << " [--prefetch next-line|stride|stream[:degree[:delay]]] [--victim <entries>]"
+                  << " [--write back|through[:allocate|no-allocate|around]] [--wbuf <entries>] [--3c]"
+                  << " [--pc-profile <top_n>] [--heatmap <file.csv|file.pgm>[:interval]]"
+                  << " [--reuse] [--save-checkpoint <file>] [--stop-after <instructions>]"
+                  << " [--sample <k>|random:<count>[:seed]] [--sector 8|16|32] [--mshr <entries>]"
+                  << " [--harts <count>[:mesi|moesi]] [--sv32 <root>[:identity|mega]]"
+                  << " [--itlb|--dtlb <entries>[:<ways>[:lru|fifo|random]]]"
+                  << " [--bpred static|bimodal|gshare|tage[,...][:table_bits[:history_bits]]]"
+                  << " [--btb <entries>] [--ras <entries>] [--record-trace <file>]" << std::endl
+                  << "       " << argv[0] << " --trace <file.din|binary trace> [--record-trace <file>] [--jobs <threads>]"
+                  << " [cache options]" << std::endl
+                  << "       " << argv[0] << " --batch <list_file|directory> [--jobs <threads>] [--csv <file>]"
+                  << " [simulation options]" << std::endl
+                  << "       " << argv[0] << " -i <input_file|elf32> | --trace <file> --sweep <axis>=<values>[;...]..."
+                  << " [--jobs <threads>] [--csv <file>] [--timing]"
+                  << " (axes: size, line, ways, policy=lru,bplru, write=<write spec>,...;"
+                  << " values: n[K|M][,...] or a-b for powers of two)" << std::endl;
+        return 1;
+    }
+    
+    if (config.harts > 1 && (!load_file.empty() || !save_file.empty())) {
+        std::cerr << "Checkpoints hold a single hart; --harts cannot be combined with them" << std::endl;
+        return 1;
+    }
+    
+    // Состояние анализаторов не сохраняется: продолженный прогон начал бы их
+    // с холодного состояния поверх накопленных счётчиков
+    if ((!load_file.empty() || !save_file.empty()) &&
+        (config.classify_misses || config.prefetch.type != PrefetcherType::NONE || config.reuse_distance ||
+         config.pc_profile > 0 || !config.branch.predictors.empty() || config.pipeline)) {
+        std::cerr << "Checkpoints do not hold 3C, prefetcher, reuse, PC profile, branch predictor or pipeline"
+                  << " state; --3c, --prefetch, --reuse, --pc-profile, --bpred and --pipeline cannot be"
+                  << " combined with them" << std::endl;
+        return 1;
     }
     
-    if (input_file.empty()) {
-        std::cerr << "Usage: " << argv[0] << " -i <input_file> [-o <output_file> <start_addr> <size>] [-d]" << std::endl;
+    // Трасса пишется из одного L1 в прогоне LRU
+    if (!record_file.empty() && (config.harts > 1 || sweep_enabled)) {
+        std::cerr << "--record-trace cannot be combined with --harts or --sweep" << std::endl;
         return 1;
     }
     
+    // Трасса без программы: данные неизвестны, нечего исполнять и сохранять.
+    // Опкодов в трассе нет, так что такты исполнения не восстановить
+    if (!trace_file.empty()) {
+        if (has_output || !save_file.empty() || stop_after > 0 || config.harts > 1 || config.sv32 ||
+            config.mshr_entries > 0 || config.pipeline || !config.branch.predictors.empty() ||
+            config.latency.enabled) {
+            std::cerr << "--trace cannot be combined with -o, checkpoints, --stop-after, --harts, --sv32,"
+                      << " --mshr, --pipeline, --bpred, --timing or --lat" << std::endl;
+            return 1;
+        }
+        config.tag_only = true;
+        config.trace_driven = true;
+    }
+    
     try {
+        if (sweep_enabled) {
+            // SweepCache моделирует один холодный L1 без дополнительных механизмов и
+            // отчётов: точки печатаются только в CSV
+            if (config.levels.size() != 1 || config.levels[0].victim_entries > 0 ||
+                config.prefetch.type != PrefetcherType::NONE || config.sector_size != CACHE_LINE_SIZE ||
+                config.mshr_entries > 0 || config.write_buffer > 0 || config.harts > 1 || config.sv32 ||
+                config.pipeline || has_output || !save_file.empty() || !load_file.empty() ||
+                !heat_file.empty() || config.classify_misses || config.reuse_distance ||
+                config.pc_profile > 0 || !config.branch.predictors.empty()) {
+                throw std::runtime_error("--sweep models a single cold L1: it cannot be combined with extra "
+                                         "levels, victim cache, prefetch, sectors, MSHRs, write buffer, harts, "
+                                         "MMU, pipeline, -o, checkpoints, heat maps, --3c, --reuse, "
+                                         "--pc-profile or --bpred");
+            }
+            std::vector<SweepPoint> points = enumerate_sweep(sweep, config);
+            if (points.empty()) throw std::runtime_error("--sweep has no valid points");
+            
+            TraceBuffer trace;
+            RiscVEmulator emu(true, config);
+            uint64_t base_cycles = 0;
+            if (!trace_file.empty()) {
+                // SweepCache не ограничен памятью эмулятора: адреса как есть
+                MappedFile file;
+                file.open_file(trace_file);
+                for_each_trace_record(file, [&](const TraceRecord& r) {
+                    trace.records.push_back(r);
+                    if (r.type == AccessType::INSTR) emu.instret++;
+                });
+            } else {
+                if (!prepare_emulator(emu, input_file, load_file, "_lru")) return 1;
+                emu.stop_after = stop_after;
+                emu.cache->trace_sink = &trace;
+                emu.run();
+                
+                // Такты вне L1 (исполнение, перенаправления) общие для всех точек
+                const Cache::Statistics& st = emu.cache->stats;
+                uint64_t access = st.instr_access + st.data_read_access + st.data_write_access;
+                base_cycles = emu.cycles - (st.cycles - (uint64_t)emu.cache->hit_latency * access);
+            }
+            
+            run_sweep(points, trace.records, config, jobs);
+            if (csv_file.empty()) {
+                write_sweep_csv(std::cout, points, config.latency.enabled, emu.instret, base_cycles);
+            } else {
+                std::ofstream out(csv_file);
+                if (!out) {
+                    std::cerr << "Failed to write CSV: " << csv_file << std::endl;
+                    return 1;
+                }
+                write_sweep_csv(out, points, config.latency.enabled, emu.instret, base_cycles);
+            }
+            return 0;
+        }
+        
+        MappedFile trace;
+        if (!trace_file.empty()) {
+            trace.open_file(trace_file);
+            if (config.pc_profile > 0 && !trace_has_pc(trace)) {
+                throw std::runtime_error("--pc-profile needs PCs, which din traces do not carry");
+            }
+        }
+        
         // Run with LRU
-        RiscVEmulator emu_lru(true);
-        if (!read_input_file(input_file.c_str(), emu_lru)) {
-            std::cerr << "Failed to read input file: " << input_file << std::endl;
-            return 1;
+        RiscVEmulator emu_lru(true, config);
+        RiscVEmulator emu_plru(false, config);
+        // Поток обращений не зависит от политики: пишется только прогон LRU
+        TraceWriter recorder;
+        if (!record_file.empty()) {
+            recorder.open_file(record_file);
+            emu_lru.cache->trace_sink = &recorder;
+        }
+        // Отчёты, которых нет у SweepCache, требуют полного Cache
+        bool sweep_replay = !trace_file.empty() && config.levels.size() == 1 &&
+            config.levels[0].victim_entries == 0 && config.prefetch.type == PrefetcherType::NONE &&
+            config.sector_size == CACHE_LINE_SIZE && config.write_buffer == 0 && !config.classify_misses &&
+            !config.reuse_distance && config.pc_profile == 0 && config.sample_every == 0 &&
+            config.sample_random == 0 && heat_file.empty() && record_file.empty() && !report_traffic && !g_debug;
+        if (sweep_replay) {
+            replay_trace_sweep(trace, config, jobs, emu_lru, emu_plru);
+        } else if (!trace_file.empty()) {
+            // Прогоны независимы: трасса отображена один раз, политики - на двух ядрах
+            std::exception_ptr plru_error;
+            std::thread plru_replay([&]() {
+                try {
+                    emu_plru.replay_trace(trace);
+                } catch (...) {
+                    plru_error = std::current_exception();
+                }
+            });
+            try {
+                emu_lru.replay_trace(trace);
+            } catch (...) {
+                plru_replay.join();
+                throw;
+            }
+            plru_replay.join();
+            if (plru_error) std::rethrow_exception(plru_error);
+        } else {
+            if (!prepare_emulator(emu_lru, input_file, load_file, "_lru")) return 1;
+            emu_lru.stop_after = stop_after;
+            emu_lru.keep_dirty = !save_file.empty();
+            emu_lru.run();
         }
-        emu_lru.run();
         
         // Run with bit-pLRU
-        RiscVEmulator emu_plru(false);
-        if (!read_input_file(input_file.c_str(), emu_plru)) {
-            std::cerr << "Failed to read input file: " << input_file << std::endl;
-            return 1;
+        if (trace_file.empty()) {
+            if (!prepare_emulator(emu_plru, input_file, load_file, "_bplru")) return 1;
+            emu_plru.stop_after = stop_after;
+            emu_plru.keep_dirty = !save_file.empty();
+            emu_plru.run();
+        }
+        if (!record_file.empty()) recorder.finish();
+        
+        if (!save_file.empty()) {
+            if (!save_checkpoint(with_suffix(save_file, "_lru"), emu_lru) ||
+                !save_checkpoint(with_suffix(save_file, "_bplru"), emu_plru)) {
+                std::cerr << "Failed to write checkpoint: " << save_file << std::endl;
+                return 1;
+            }
         }
-        emu_plru.run();
         
         // Calculate hit rates
         double lru_hit_rate = 0.0, lru_instr_rate = 0.0, lru_data_rate = 0.0;
         double plru_hit_rate = 0.0, plru_instr_rate = 0.0, plru_data_rate = 0.0;
+        const Cache::Statistics lru_stats = emu_lru.l1_stats();
+        const Cache::Statistics plru_stats = emu_plru.l1_stats();
         
-        uint64_t lru_total = emu_lru.cache->stats.instr_access + 
-                             emu_lru.cache->stats.data_read_access + 
-                             emu_lru.cache->stats.data_write_access;
-        uint64_t lru_hits = emu_lru.cache->stats.instr_hit + 
-                            emu_lru.cache->stats.data_read_hit + 
-                            emu_lru.cache->stats.data_write_hit;
+        uint64_t lru_total = lru_stats.instr_access + 
+                             lru_stats.data_read_access + 
+                             lru_stats.data_write_access;
+        uint64_t lru_hits = lru_stats.instr_hit + 
+                            lru_stats.data_read_hit + 
+                            lru_stats.data_write_hit;
         
         if (lru_total > 0) lru_hit_rate = (double)lru_hits / lru_total * 100.0;
-        if (emu_lru.cache->stats.instr_access > 0) 
-            lru_instr_rate = (double)emu_lru.cache->stats.instr_hit / emu_lru.cache->stats.instr_access * 100.0;
+        if (lru_stats.instr_access > 0) 
+            lru_instr_rate = (double)lru_stats.instr_hit / lru_stats.instr_access * 100.0;
         
-        uint64_t lru_data_total = emu_lru.cache->stats.data_read_access + emu_lru.cache->stats.data_write_access;
-        uint64_t lru_data_hits = emu_lru.cache->stats.data_read_hit + emu_lru.cache->stats.data_write_hit;
+        uint64_t lru_data_total = lru_stats.data_read_access + lru_stats.data_write_access;
+        uint64_t lru_data_hits = lru_stats.data_read_hit + lru_stats.data_write_hit;
         if (lru_data_total > 0)
             lru_data_rate = (double)lru_data_hits / lru_data_total * 100.0;
         
-        uint64_t plru_total = emu_plru.cache->stats.instr_access + 
-                              emu_plru.cache->stats.data_read_access + 
-                              emu_plru.cache->stats.data_write_access;
-        uint64_t plru_hits = emu_plru.cache->stats.instr_hit + 
-                             emu_plru.cache->stats.data_read_hit + 
-                             emu_plru.cache->stats.data_write_hit;
+        uint64_t plru_total = plru_stats.instr_access + 
+                              plru_stats.data_read_access + 
+                              plru_stats.data_write_access;
+        uint64_t plru_hits = plru_stats.instr_hit + 
+                             plru_stats.data_read_hit + 
+                             plru_stats.data_write_hit;
         
         if (plru_total > 0) plru_hit_rate = (double)plru_hits / plru_total * 100.0;
-        if (emu_plru.cache->stats.instr_access > 0)
-            plru_instr_rate = (double)emu_plru.cache->stats.instr_hit / emu_plru.cache->stats.instr_access * 100.0;
+        if (plru_stats.instr_access > 0)
+            plru_instr_rate = (double)plru_stats.instr_hit / plru_stats.instr_access * 100.0;
         
-        uint64_t plru_data_total = emu_plru.cache->stats.data_read_access + emu_plru.cache->stats.data_write_access;
-        uint64_t plru_data_hits = emu_plru.cache->stats.data_read_hit + emu_plru.cache->stats.data_write_hit;
+        uint64_t plru_data_total = plru_stats.data_read_access + plru_stats.data_write_access;
+        uint64_t plru_data_hits = plru_stats.data_read_hit + plru_stats.data_write_hit;
         if (plru_data_total > 0)
             plru_data_rate = (double)plru_data_hits / plru_data_total * 100.0;
         
@@ -755,41 +5961,219 @@ int main(int argc, char* argv[]) {
         printf("| replacement | hit_rate | instr_hit_rate | data_hit_rate | instr_access | instr_hit | data_access | data_hit |\n");
         printf("| :---------- | :-----: | -------------: | ------------: | -----------: | ---------: | ----------: | --------: |\n");
         
-        if (lru_total == 0) {
+        if (emu_lru.cache->sampling) {
+            print_sampled_row("LRU", emu_lru);
+        } else if (lru_total == 0) {
             printf("| LRU | nan%% | nan%% | nan%% | %12d | %12d | %12d | %12d |\n",
                    0, 0, 0, 0);
         } else {
             printf("| LRU | %3.4f%% | %3.4f%% | %3.4f%% | %12lu | %12lu | %12lu | %12lu |\n",
                    lru_hit_rate, lru_instr_rate, lru_data_rate,
-                   (unsigned long)emu_lru.cache->stats.instr_access, 
-                   (unsigned long)emu_lru.cache->stats.instr_hit,
+                   (unsigned long)lru_stats.instr_access, 
+                   (unsigned long)lru_stats.instr_hit,
                    (unsigned long)lru_data_total, 
                    (unsigned long)lru_data_hits);
         }
         
-        if (plru_total == 0) {
+        if (emu_plru.cache->sampling) {
+            print_sampled_row("bpLRU", emu_plru);
+        } else if (plru_total == 0) {
             printf("| bpLRU | nan%% | nan%% | nan%% | %12d | %12d | %12d | %12d |\n",
                    0, 0, 0, 0);
         } else {
             printf("| bpLRU | %3.4f%% | %3.4f%% | %3.4f%% | %12lu | %12lu | %12lu | %12lu |\n",
                    plru_hit_rate, plru_instr_rate, plru_data_rate,
-                   (unsigned long)emu_plru.cache->stats.instr_access, 
-                   (unsigned long)emu_plru.cache->stats.instr_hit,
+                   (unsigned long)plru_stats.instr_access, 
+                   (unsigned long)plru_stats.instr_hit,
                    (unsigned long)plru_data_total, 
                    (unsigned long)plru_data_hits);
         }
         
+        // Per-level statistics for multi-level hierarchies
+        if (config.levels.size() > 1) {
+            printf("\n| replacement | level | inclusion | geometry | access | hit | hit_rate | writebacks | back_invalidations |\n");
+            printf("| :---------- | :---- | :-------- | :------: | -----: | --: | -------: | ---------: | -----------------: |\n");
+            print_hierarchy_stats("LRU", emu_lru);
+            print_hierarchy_stats("bpLRU", emu_plru);
+        }
+        
+        // Cycle model: CPI and average memory access time per level
+        if (config.latency.enabled) {
+            printf("\n| replacement | instructions | cycles | CPI |");
+            for (const CacheConfig& level : config.levels) printf(" %s_AMAT |", level.name.c_str());
+            printf("\n| :---------- | -----------: | -----: | --: |");
+            for (size_t i = 0; i < config.levels.size(); i++) printf(" -------: |");
+            printf("\n");
+            print_timing_stats("LRU", emu_lru);
+            print_timing_stats("bpLRU", emu_plru);
+        }
+        
+        // Pipeline: where the cycles above one per instruction went
+        if (config.pipeline) {
+            printf("\n| replacement | cycles | fill | fetch | load_use | raw | execute | memory | control | stall_share |\n");
+            printf("| :---------- | -----: | ---: | ----: | -------: | --: | ------: | -----: | ------: | ----------: |\n");
+            print_pipeline_stats("LRU", emu_lru);
+            print_pipeline_stats("bpLRU", emu_plru);
+        }
+        
+        // Address translation: TLB hit rates and page walks through L1
+        if (config.sv32) {
+            printf("\n| replacement | tlb | geometry | policy | reach_kb | access | hit | hit_rate | evictions |\n");
+            printf("| :---------- | :-- | :------: | :----- | -------: | -----: | --: | -------: | --------: |\n");
+            print_tlb_stats("LRU", emu_lru.mmu->itlb);
+            print_tlb_stats("LRU", emu_lru.mmu->dtlb);
+            print_tlb_stats("bpLRU", emu_plru.mmu->itlb);
+            print_tlb_stats("bpLRU", emu_plru.mmu->dtlb);
+            
+            printf("\n| replacement | walks | pte_reads | megapage_walks | L1_walk_access | L1_walk_hit | L1_walk_hit_rate | walk_cycles |\n");
+            printf("| :---------- | ----: | --------: | -------------: | -------------: | ----------: | ---------------: | ----------: |\n");
+            print_walk_stats("LRU", emu_lru);
+            print_walk_stats("bpLRU", emu_plru);
+        }
+        
+        // Coherence traffic between the private L1s of all harts
+        if (config.harts > 1) {
+            printf("\n| replacement | hart | instructions | access | misses | coherence_misses | false_sharing | invalidations | upgrades | c2c_transfers | snoop_writebacks |\n");
+            printf("| :---------- | ---: | -----------: | -----: | -----: | ---------------: | ------------: | ------------: | -------: | ------------: | ---------------: |\n");
+            print_coherence_stats("LRU", emu_lru);
+            print_coherence_stats("bpLRU", emu_plru);
+        }
+        
+        // Non-blocking L1: misses in flight and the cycles they still cost
+        if (config.mshr_entries > 0) {
+            printf("\n| replacement | mshr | primary_misses | merged | peak | mlp | full_stalls | full_stall_cycles | data_stall_cycles | cycles |\n");
+            printf("| :---------- | ---: | -------------: | -----: | ---: | --: | ----------: | ----------------: | ----------------: | -----: |\n");
+            print_mshr_stats("LRU", emu_lru);
+            print_mshr_stats("bpLRU", emu_plru);
+            
+            printf("\n| replacement |");
+            for (uint32_t n = 0; n <= config.mshr_entries; n++) printf(" %u_in_flight |", n);
+            printf("\n| :---------- |");
+            for (uint32_t n = 0; n <= config.mshr_entries; n++) printf(" ----------: |");
+            printf("\n");
+            print_mshr_occupancy("LRU", emu_lru);
+            print_mshr_occupancy("bpLRU", emu_plru);
+        }
+        
+        // Prefetcher effectiveness (separate from demand hit rates above)
+        if (config.prefetch.type != PrefetcherType::NONE) {
+            printf("\n| replacement | prefetcher | issued | filled | useful | late | useless | pollution | accuracy | coverage | timeliness |\n");
+            printf("| :---------- | :--------- | -----: | -----: | -----: | ---: | ------: | --------: | -------: | -------: | ---------: |\n");
+            print_prefetch_stats("LRU", emu_lru);
+            print_prefetch_stats("bpLRU", emu_plru);
+        }
+        
+        // Victim cache: how many set-conflict misses it rescues
+        if (config.levels[0].victim_entries > 0) {
+            printf("\n| replacement | victim_entries | probes | hits | rescued_misses | inserts | writebacks |\n");
+            printf("| :---------- | -------------: | -----: | ---: | -------------: | ------: | ---------: |\n");
+            print_victim_stats("LRU", emu_lru);
+            print_victim_stats("bpLRU", emu_plru);
+        }
+        
+        // 3C breakdown: conflict misses want ways, capacity misses want size
+        if (config.classify_misses) {
+            printf("\n| replacement | level | misses | compulsory | capacity | conflict | conflict_share |\n");
+            printf("| :---------- | :---- | -----: | ---------: | -------: | -------: | -------------: |\n");
+            print_miss_classes("LRU", emu_lru);
+            print_miss_classes("bpLRU", emu_plru);
+        }
+        
+        // Instructions responsible for data misses
+        if (config.pc_profile > 0) {
+            printf("\n| replacement | pc | instruction | access | hit | miss | miss_rate | writebacks |\n");
+            printf("| :---------- | :- | :---------- | -----: | --: | ---: | --------: | ---------: |\n");
+            print_pc_profile("LRU", emu_lru, config.pc_profile);
+            print_pc_profile("bpLRU", emu_plru, config.pc_profile);
+        }
+        
+        // Control flow: predictor accuracy, target prediction, worst branches
+        if (!config.branch.predictors.empty()) {
+            printf("\n| predictor | branches | taken | mispredicts | accuracy | mpki | redirects | penalty_cycles |\n");
+            printf("| :-------- | -------: | ----: | ----------: | -------: | ---: | --------: | -------------: |\n");
+            print_predictor_stats(emu_lru);
+            
+            printf("\n| jumps | returns | btb_entries | btb_hit_rate | ras_entries | ras_hit_rate | ras_overflows |\n");
+            printf("| ----: | ------: | ----------: | -----------: | ----------: | -----------: | ------------: |\n");
+            print_target_stats(emu_lru);
+            
+            printf("\n| pc | instruction | executions | taken_rate | mispredicts | accuracy |\n");
+            printf("| :- | :---------- | ---------: | ---------: | ----------: | -------: |\n");
+            print_branch_sites(emu_lru, config.branch.profile);
+        }
+        
+        // Reuse distance in cache lines (same stream for both replacements)
+        if (config.reuse_distance) {
+            printf("\n| reuse_distance | instr | data | instr_cumulative | data_cumulative |\n");
+            printf("| :------------- | ----: | ---: | ---------------: | --------------: |\n");
+            print_reuse_histogram(emu_lru);
+        }
+        
+        // Per-set view of L1: thrashing sets, heat map files, occupancy
+        if (config.heat_interval > 0) {
+            printf("\n| replacement | set | access | miss | miss_rate | evictions |\n");
+            printf("| :---------- | --: | -----: | ---: | --------: | --------: |\n");
+            print_set_stats("LRU", emu_lru);
+            print_set_stats("bpLRU", emu_plru);
+            
+            printf("\n| replacement |");
+            for (uint32_t k = 0; k <= config.levels[0].ways; k++) printf(" valid_%u |", k);
+            printf("\n| :---------- |");
+            for (uint32_t k = 0; k <= config.levels[0].ways; k++) printf(" ------: |");
+            printf("\n");
+            print_occupancy("LRU", emu_lru);
+            print_occupancy("bpLRU", emu_plru);
+            
+            if (!write_heat_map(with_suffix(heat_file, "_lru"), emu_lru.cache) ||
+                !write_heat_map(with_suffix(heat_file, "_bplru"), emu_plru.cache)) {
+                std::cerr << "Failed to write heat map: " << heat_file << std::endl;
+                return 1;
+            }
+        }
+        
+        // Sectored last level: fill and writeback bandwidth
+        if (config.sector_size != CACHE_LINE_SIZE) {
+            printf("\n| replacement | level | sector_bytes | sector_misses | fill_bytes | writeback_bytes | writebacks |\n");
+            printf("| :---------- | :---- | -----------: | ------------: | ---------: | --------------: | ---------: |\n");
+            print_sector_stats("LRU", emu_lru);
+            print_sector_stats("bpLRU", emu_plru);
+        }
+        
+        // Memory-side traffic: what the write policy costs in bytes
+        if (report_traffic) {
+            printf("\n| replacement | write_policy | write_buffer | mem_read_bytes | mem_write_bytes | write_requests | coalesced | memory_writes | buffer_stalls |\n");
+            printf("| :---------- | :----------- | -----------: | -------------: | --------------: | -------------: | --------: | ------------: | ------------: |\n");
+            print_traffic_stats("LRU", emu_lru);
+            print_traffic_stats("bpLRU", emu_plru);
+        }
+        
+        // Recorded trace: delta/varint size and what block compression saved
+        if (!record_file.empty()) {
+            printf("\n| trace_records | encoded_bytes | file_bytes | bytes_per_record | compression |\n");
+            printf("| ------------: | ------------: | ---------: | ---------------: | ----------: |\n");
+            printf("| %lu | %lu | %lu | %.3f | %.2fx |\n",
+                   (unsigned long)recorder.records, (unsigned long)recorder.raw_bytes,
+                   (unsigned long)recorder.file_bytes,
+                   recorder.records ? (double)recorder.file_bytes / recorder.records : 0.0,
+                   (double)recorder.records * sizeof(TraceRecord) / recorder.file_bytes);
+        }
+        
         // Print detailed stats if debug enabled
         if (g_debug) {
-            printf("\n=== LRU Statistics ===\n");
-            emu_lru.cache->print_detailed_stats();
+            for (Cache* c : emu_lru.hierarchy) {
+                printf("\n=== LRU Statistics (%s) ===\n", c->name.c_str());
+                c->print_detailed_stats();
+            }
             
-            printf("\n=== bit-pLRU Statistics ===\n");
-            emu_plru.cache->print_detailed_stats();
+            for (Cache* c : emu_plru.hierarchy) {
+                printf("\n=== bit-pLRU Statistics (%s) ===\n", c->name.c_str());
+                c->print_detailed_stats();
+            }
         }
         
         // Write output if requested
         if (has_output) {
+            emu_lru.cache->flush();     // после checkpoint грязные линии ещё в кэше
             if (!write_output_file(output_file.c_str(), emu_lru, output_addr, output_size)) {
                 std::cerr << "Failed to write output file: " << output_file << std::endl;
                 return 1;